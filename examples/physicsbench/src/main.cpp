@@ -0,0 +1,421 @@
+#include <chrono>
+#include <random>
+#include <atomic>
+#include <new>
+#include <cstdio>
+#include <numbers>
+
+#include "PhysicsHandler.h"
+
+/*
+ * Headless PhysicsHandler benchmark. Runs a handful of scripted scenarios and writes one JSON object
+ * per run, so results can be saved per commit and compared:
+ *     ./PhysicsBench [threads] [output path]
+ * threads is given to each PhysicsHandler (default 1), output defaults to physicsbench.json. It goes
+ * to a file rather than stdout since PhysicsHandler still prints debug output of its own. A few
+ * scenarios then run again at 1, 2, 4 and 8 threads whatever threads is, each run tagged with its count.
+ *
+ * Updates are driven through update() with an injected clock that advances exactly BENCH_DT per read,
+ * so every run simulates the same thing no matter how fast the machine is.
+ */
+
+#define BENCH_DT (1.f / 60.f)
+#define BENCH_GRAVITY glm::vec3(0, -9.807, 0)
+#define SPHERE_RADIUS 0.5f
+#define STACK_HEIGHT 20
+#define TERRAIN_SIZE 100.f // m along x and z
+#define TERRAIN_RES 100 // quads along x and z
+#define TERRAIN_PATH "physicsbench_terrain.obj"
+#define PROJECTILE_LAYER 0x2u
+#define BULLET_RADIUS 0.05f
+#define BULLET_SPEED 40.f // m/s, so about 13 radii per step
+
+/*
+ * Allocation counting
+ */
+
+std::atomic<size_t> numallocs(0);
+
+void* operator new(size_t n) {
+	numallocs.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = malloc(n ? n : 1)) return p;
+	throw std::bad_alloc();
+}
+void* operator new[](size_t n) {return operator new(n);}
+void operator delete(void* p) noexcept {free(p);}
+void operator delete[](void* p) noexcept {free(p);}
+void operator delete(void* p, size_t) noexcept {free(p);}
+void operator delete[](void* p, size_t) noexcept {free(p);}
+
+/*
+ * Scenarios
+ */
+
+typedef struct Scenario {
+	const char* name;
+	PhysicsBroadphaseType broadphase;
+	float cellsize;
+	size_t n; // roughly the number of colliders, exact meaning is up to setup
+	size_t warmup, steps; // warmup steps are simulated but not measured
+	void (*setup)(PhysicsHandler&, size_t, std::mt19937&);
+	bool sleeping = true, warmstarting = true;
+	// steps call every collider's own update instead of the handler's, to compare against batched integration
+	bool percollider = false;
+	void (*perstep)(PhysicsHandler&, size_t) = nullptr; // called before each measured step, with its index
+} Scenario;
+
+Collider* addStatic(Collider* c, glm::vec3 p) {
+	c->setMass(std::numeric_limits<float>::infinity());
+	c->setPos(p);
+	return c;
+}
+
+// spheres dropped from random heights onto a plane, most end up resting (and asleep)
+void setupRain(PhysicsHandler& ph, size_t n, std::mt19937& rng) {
+	float side = sqrtf((float)n) * 1.5f;
+	std::uniform_real_distribution<float> xz(0, side), h(1, 20);
+	addStatic(ph.addCollider(PlaneCollider(glm::vec3(0, 1, 0))), glm::vec3(0));
+	for (size_t i = 0; i < n; i++) {
+		Collider* c = ph.addCollider(SphereCollider(SPHERE_RADIUS));
+		c->setPos(glm::vec3(xz(rng), h(rng), xz(rng)));
+		c->applyForce(BENCH_GRAVITY);
+	}
+}
+
+float terrainHeight(float x, float z) {
+	return sinf(x * 0.3f) * 2 + cosf(z * 0.2f) * 3;
+}
+
+void writeTerrain() {
+	FILE* obj = fopen(TERRAIN_PATH, "w");
+	if (!obj) FatalError("Couldn't write " TERRAIN_PATH).raise();
+	float x, z;
+	for (uint32_t j = 0; j <= TERRAIN_RES; j++) {
+		for (uint32_t i = 0; i <= TERRAIN_RES; i++) {
+			x = i * TERRAIN_SIZE / TERRAIN_RES;
+			z = j * TERRAIN_SIZE / TERRAIN_RES;
+			fprintf(obj, "v %f %f %f\n", x, terrainHeight(x, z), z);
+		}
+	}
+	fprintf(obj, "vt 0 0\nvn 0 1 0\n");
+	uint32_t a, b, c, d;
+	for (uint32_t j = 0; j < TERRAIN_RES; j++) {
+		for (uint32_t i = 0; i < TERRAIN_RES; i++) {
+			a = j * (TERRAIN_RES + 1) + i + 1;
+			b = a + 1;
+			c = a + TERRAIN_RES + 1;
+			d = c + 1;
+			// CCW seen from +y
+			fprintf(obj, "f %u/1/1 %u/1/1 %u/1/1\n", a, c, b);
+			fprintf(obj, "f %u/1/1 %u/1/1 %u/1/1\n", b, c, d);
+		}
+	}
+	fclose(obj);
+}
+
+// points walking in random directions across a rolling MeshCollider, like a crowd of cameras
+void setupTerrain(PhysicsHandler& ph, size_t n, std::mt19937& rng) {
+	writeTerrain();
+	addStatic(ph.addCollider(MeshCollider(TERRAIN_PATH)), glm::vec3(0));
+	std::uniform_real_distribution<float> xz(TERRAIN_SIZE * 0.3f, TERRAIN_SIZE * 0.7f), v(-3, 3);
+	for (size_t i = 0; i < n; i++) {
+		Collider* c = ph.addCollider(PointCollider());
+		c->setPos(glm::vec3(xz(rng), 8, xz(rng)));
+		c->applyMomentum(c->getMass() * glm::vec3(v(rng), 0, v(rng)));
+		c->applyForce(BENCH_GRAVITY);
+	}
+}
+
+// as terrain_walk, but over a 3x3 tiling of one terrain turned to a different quarter for each tile, all sharing its data
+void setupTerrainInstances(PhysicsHandler& ph, size_t n, std::mt19937& rng) {
+	writeTerrain();
+	std::shared_ptr<const MeshColliderData> data = std::make_shared<const MeshColliderData>(TERRAIN_PATH);
+	glm::vec3 center(TERRAIN_SIZE / 2, 0, TERRAIN_SIZE / 2);
+	for (uint32_t i = 0; i < 9; i++) {
+		float theta = (i % 4) * std::numbers::pi_v<float> / 4; // half the turn, for the quaternion
+		glm::quat r(cosf(theta), 0, sinf(theta), 0);
+		MeshCollider* m = static_cast<MeshCollider*>(ph.addCollider(MeshCollider(data)));
+		m->setRot(r);
+		addStatic(m, glm::vec3(i % 3 + 0.5f, 0, i / 3 + 0.5f) * TERRAIN_SIZE - r * center);
+	}
+	std::uniform_real_distribution<float> xz(TERRAIN_SIZE * 0.3f, TERRAIN_SIZE * 2.7f), v(-3, 3);
+	for (size_t i = 0; i < n; i++) {
+		Collider* c = ph.addCollider(PointCollider());
+		c->setPos(glm::vec3(xz(rng), 8, xz(rng)));
+		c->applyMomentum(c->getMass() * glm::vec3(v(rng), 0, v(rng)));
+		c->applyForce(BENCH_GRAVITY);
+	}
+}
+
+// terrainHeight again, sampled into a heightfield
+Collider* addHeightfield(PhysicsHandler& ph) {
+	const float heightscale = 10.f / UINT16_MAX; // terrainHeight is within ±5
+	std::vector<uint16_t> samples((TERRAIN_RES + 1) * (TERRAIN_RES + 1));
+	for (uint32_t j = 0; j <= TERRAIN_RES; j++) {
+		for (uint32_t i = 0; i <= TERRAIN_RES; i++) {
+			samples[j * (TERRAIN_RES + 1) + i] = roundf((terrainHeight(i * TERRAIN_SIZE / TERRAIN_RES, j * TERRAIN_SIZE / TERRAIN_RES) + 5) / heightscale);
+		}
+	}
+	return addStatic(ph.addCollider(HeightfieldCollider(TERRAIN_RES + 1, TERRAIN_RES + 1, TERRAIN_SIZE / TERRAIN_RES, heightscale, std::move(samples))), glm::vec3(0, -5, 0));
+}
+
+// as terrain_walk, over a HeightfieldCollider sampled from the same terrain
+void setupHeightfield(PhysicsHandler& ph, size_t n, std::mt19937& rng) {
+	// point-mesh contacts have no friction, so take it off here too or these would slow to a stop and not compare
+	addHeightfield(ph)->setFrictionDyn(0);
+	std::uniform_real_distribution<float> xz(TERRAIN_SIZE * 0.3f, TERRAIN_SIZE * 0.7f), v(-3, 3);
+	for (size_t i = 0; i < n; i++) {
+		Collider* c = ph.addCollider(PointCollider());
+		c->setFrictionDyn(0);
+		c->setPos(glm::vec3(xz(rng), 8, xz(rng)));
+		c->applyMomentum(c->getMass() * glm::vec3(v(rng), 0, v(rng)));
+		c->applyForce(BENCH_GRAVITY);
+	}
+}
+
+// small fast spheres fired down at the heightfield at a shallow angle, skipping across it
+void setupBullets(PhysicsHandler& ph, size_t n, std::mt19937& rng) {
+	addHeightfield(ph);
+	std::uniform_real_distribution<float> xz(TERRAIN_SIZE * 0.3f, TERRAIN_SIZE * 0.7f), a(0, 2 * std::numbers::pi_v<float>);
+	for (size_t i = 0; i < n; i++) {
+		Collider* c = ph.addCollider(SphereCollider(BULLET_RADIUS));
+		c->setPos(glm::vec3(xz(rng), 8, xz(rng)));
+		c->setFast(true);
+		float ai = a(rng);
+		c->applyMomentum(c->getMass() * glm::vec3(BULLET_SPEED * cosf(ai), -BULLET_SPEED / 4, BULLET_SPEED * sinf(ai)));
+		c->applyForce(BENCH_GRAVITY);
+	}
+}
+
+// columns of STACK_HEIGHT touching spheres on a plane
+void setupStacks(PhysicsHandler& ph, size_t n, std::mt19937& /*rng*/) {
+	size_t numcols = std::max((size_t)1, n / STACK_HEIGHT), side = ceil(sqrt((double)numcols));
+	addStatic(ph.addCollider(PlaneCollider(glm::vec3(0, 1, 0))), glm::vec3(0));
+	for (size_t ci = 0; ci < numcols; ci++) {
+		for (size_t hi = 0; hi < STACK_HEIGHT; hi++) {
+			Collider* c = ph.addCollider(SphereCollider(SPHERE_RADIUS));
+			c->setPos(glm::vec3(ci % side * 4 * SPHERE_RADIUS, (2 * hi + 1) * SPHERE_RADIUS, ci / side * 4 * SPHERE_RADIUS));
+			c->applyForce(BENCH_GRAVITY);
+		}
+	}
+}
+
+// spheres bouncing around a box made of RectColliders
+void setupWalls(PhysicsHandler& ph, size_t n, std::mt19937& rng) {
+	float side = sqrtf((float)n) * 1.5f, hside = side / 2;
+	addStatic(ph.addCollider(RectCollider(glm::vec3(0, 1, 0), glm::vec2(hside))), glm::vec3(0));
+	addStatic(ph.addCollider(RectCollider(glm::vec3(1, 0, 0), glm::vec2(hside))), glm::vec3(-hside, hside, 0));
+	addStatic(ph.addCollider(RectCollider(glm::vec3(-1, 0, 0), glm::vec2(hside))), glm::vec3(hside, hside, 0));
+	addStatic(ph.addCollider(RectCollider(glm::vec3(0, 0, 1), glm::vec2(hside))), glm::vec3(0, hside, -hside));
+	addStatic(ph.addCollider(RectCollider(glm::vec3(0, 0, -1), glm::vec2(hside))), glm::vec3(0, hside, hside));
+	std::uniform_real_distribution<float> xz(-hside + 1, hside - 1), h(1, 5), v(-8, 8);
+	for (size_t i = 0; i < n; i++) {
+		Collider* c = ph.addCollider(SphereCollider(SPHERE_RADIUS));
+		c->setPos(glm::vec3(xz(rng), h(rng), xz(rng)));
+		c->applyMomentum(c->getMass() * glm::vec3(v(rng), v(rng), v(rng)));
+		c->applyForce(BENCH_GRAVITY);
+	}
+}
+
+// a grid of spheres settled on a static RectCollider, which perstepPlatform lowers out from under them like a lift
+void setupPlatform(PhysicsHandler& ph, size_t n, std::mt19937& /*rng*/) {
+	size_t side = ceilf(sqrtf((float)n));
+	float hside = side * SPHERE_RADIUS * 1.25f;
+	addStatic(ph.addCollider(RectCollider(glm::vec3(0, 1, 0), glm::vec2(hside + 1))), glm::vec3(0));
+	for (size_t i = 0; i < n; i++) {
+		Collider* c = ph.addCollider(SphereCollider(SPHERE_RADIUS));
+		c->setPos(glm::vec3((i % side) * SPHERE_RADIUS * 2.5f - hside, SPHERE_RADIUS, (i / side) * SPHERE_RADIUS * 2.5f - hside));
+		c->applyForce(BENCH_GRAVITY);
+	}
+}
+
+// every 100 steps, once the spheres have gone back to sleep; the platform is the first collider setupPlatform adds
+void perstepPlatform(PhysicsHandler& ph, size_t i) {
+	if (i % 100 != 50) return;
+	Collider* pl = ph.getCollider(0);
+	pl->setPos(pl->getPos() - glm::vec3(0, 2 * SPHERE_RADIUS, 0));
+}
+
+// spheres falling with nothing to hit, so a step is (almost) all integration
+void setupFalling(PhysicsHandler& ph, size_t n, std::mt19937& rng) {
+	std::uniform_real_distribution<float> pos(0, 100);
+	for (size_t i = 0; i < n; i++) {
+		Collider* c = ph.addCollider(SphereCollider(SPHERE_RADIUS));
+		c->setPos(glm::vec3(pos(rng), pos(rng), pos(rng)));
+		c->applyForce(BENCH_GRAVITY);
+	}
+}
+
+// free-floating spheres at constant density, mostly a broadphase test
+void setupGas(PhysicsHandler& ph, size_t n, std::mt19937& rng) {
+	float side = cbrtf((float)n) * 2.5f;
+	std::uniform_real_distribution<float> pos(0, side), vel(-2, 2);
+	for (size_t i = 0; i < n; i++) {
+		Collider* c = ph.addCollider(SphereCollider(SPHERE_RADIUS));
+		c->setPos(glm::vec3(pos(rng), pos(rng), pos(rng)));
+		c->applyMomentum(c->getMass() * glm::vec3(vel(rng), vel(rng), vel(rng)));
+	}
+}
+
+// as sphere_gas, but three in four spheres are projectiles, which collide with the rest but not each other
+void setupProjectiles(PhysicsHandler& ph, size_t n, std::mt19937& rng) {
+	setupGas(ph, n, rng);
+	for (size_t ci = 0; ci < ph.getNumColliders(); ci++) {
+		if (ci % 4 == 0) continue;
+		ph.getCollider(ci)->setLayers(PROJECTILE_LAYER);
+		ph.getCollider(ci)->setMask(~PROJECTILE_LAYER);
+	}
+}
+
+/*
+ * Running and reporting
+ */
+
+const char* phasenames[PH_PHASE_COUNT] = {"timed_values", "integrate", "broadphase", "narrowphase", "contacts", "callbacks", "sleep"};
+const char* broadphasenames[4] = {"none", "all_pairs", "sweep_and_prune", "hash_grid"};
+
+double benchClock(void* d) {
+	double& t = *static_cast<double*>(d);
+	t += BENCH_DT;
+	return t;
+}
+
+void runScenario(FILE* out, const Scenario& s, uint8_t numthreads, bool first) {
+	std::mt19937 rng(1234);
+	double t = 0;
+	PhysicsHandler ph(s.broadphase, s.cellsize);
+	ph.setClock({benchClock, &t});
+	ph.setNumThreads(numthreads);
+	ph.setSleeping(s.sleeping);
+	ph.setWarmStarting(s.warmstarting);
+	s.setup(ph, s.n, rng);
+	size_t numcolliders = ph.getNumColliders();
+
+	ph.start();
+	// the handler's own update still reads the clock, so per-collider steps advance it by hand
+	auto step = [&ph, &s, &t, numcolliders] () {
+		if (!s.percollider) {
+			ph.update();
+			return;
+		}
+		for (size_t ci = 0; ci < numcolliders; ci++) ph.getCollider(ci)->update(BENCH_DT);
+		t += BENCH_DT;
+	};
+	for (size_t i = 0; i < s.warmup; i++) step();
+
+	ph.setPhaseTiming(true);
+	size_t allocs0 = numallocs.load();
+	size_t contactiters = 0, maxcontactiters = 0;
+#ifdef PH_STATS
+	size_t checked = 0, collisions = 0, transitions = 0, tritests = 0;
+#endif
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < s.steps; i++) {
+		if (s.perstep) s.perstep(ph, i);
+		step();
+		contactiters += ph.getNumContactIterations();
+		maxcontactiters = std::max(maxcontactiters, (size_t)ph.getNumContactIterations());
+#ifdef PH_STATS
+		// one step per update here, so every step's stats get read
+		const PhysicsStats& st = ph.acquireStats();
+		checked += st.pairschecked;
+		collisions += st.collisions;
+		transitions += st.couples + st.decouples;
+		tritests += st.tritests;
+#endif
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	size_t allocs = numallocs.load() - allocs0;
+
+	// mean speed of everything that can move, resting scenarios should end up near 0
+	size_t numnan = 0, nummoving = 0;
+	double speed = 0;
+	glm::vec3 p;
+	for (size_t ci = 0; ci < numcolliders; ci++) {
+		p = ph.getCollider(ci)->getPos();
+		if (std::isnan(p.x) || std::isnan(p.y) || std::isnan(p.z)) numnan++;
+		else if (!std::isinf(ph.getCollider(ci)->getMass())) {
+			speed += glm::length(ph.getCollider(ci)->getVel());
+			nummoving++;
+		}
+	}
+
+	fprintf(out, "%s\t\t{\"name\": \"%s\", \"broadphase\": \"%s\", \"threads\": %u, \"colliders\": %zu, \"steps\": %zu, ",
+		first ? "" : ",\n", s.name, broadphasenames[s.broadphase], numthreads, numcolliders, s.steps);
+	fprintf(out, "\"steps_per_sec\": %.2f, \"allocs_per_step\": %.2f, ", s.steps / elapsed.count(), (double)allocs / s.steps);
+	fprintf(out, "\"active_pairs\": %zu, \"asleep\": %zu, \"nan_positions\": %zu, ",
+		ph.getNumActivePairs(), ph.getNumAsleep(), numnan);
+	fprintf(out, "\"warm_starting\": %s, \"contact_iterations_per_step\": %.2f, \"max_contact_iterations\": %zu, \"mean_speed\": %f,\n\t\t\t\"ns_per_collider\": {",
+		s.warmstarting ? "true" : "false", (double)contactiters / s.steps, maxcontactiters, nummoving ? speed / nummoving : 0.);
+	for (uint8_t p = 0; p < PH_PHASE_COUNT; p++) {
+		fprintf(out, "%s\"%s\": %.2f", p == 0 ? "" : ", ", phasenames[p],
+			ph.getPhaseTime((PhysicsPhase)p) * 1e9 / s.steps / numcolliders);
+	}
+	fprintf(out, "}");
+#ifdef PH_STATS
+	fprintf(out, ",\n\t\t\t\"per_step\": {\"pairs_checked\": %.1f, \"collisions\": %.1f, \"contact_transitions\": %.1f, \"tri_tests\": %.1f}",
+		(double)checked / s.steps, (double)collisions / s.steps, (double)transitions / s.steps, (double)tritests / s.steps);
+#endif
+	fprintf(out, "}");
+}
+
+int main(int argc, char** argv) {
+	uint8_t numthreads = argc > 1 ? atoi(argv[1]) : 1;
+	const char* outpath = argc > 2 ? argv[2] : "physicsbench.json";
+	FILE* out = fopen(outpath, "w");
+	if (!out) FatalError("Couldn't open output file").raise();
+
+	const Scenario scenarios[] = {
+		{"sphere_rain", PH_BROADPHASE_HASH_GRID, 2 * SPHERE_RADIUS, 10000, 60, 300, setupRain},
+		{"terrain_walk", PH_BROADPHASE_HASH_GRID, 2.f, 1000, 10, 300, setupTerrain},
+		{"terrain_instances", PH_BROADPHASE_HASH_GRID, 2.f, 1000, 10, 300, setupTerrainInstances},
+		{"heightfield_walk", PH_BROADPHASE_HASH_GRID, 2.f, 1000, 10, 300, setupHeightfield},
+		{"heightfield_bullets", PH_BROADPHASE_HASH_GRID, 2.f, 200, 1, 120, setupBullets},
+		{"sphere_stacks", PH_BROADPHASE_HASH_GRID, 2 * SPHERE_RADIUS, 50 * STACK_HEIGHT, 10, 300, setupStacks},
+		// awake the whole time, to compare how the contact solver converges with and without warm starting
+		{"sphere_stacks_awake", PH_BROADPHASE_HASH_GRID, 2 * SPHERE_RADIUS, 50 * STACK_HEIGHT, 60, 300, setupStacks, false, true},
+		{"sphere_stacks_awake", PH_BROADPHASE_HASH_GRID, 2 * SPHERE_RADIUS, 50 * STACK_HEIGHT, 60, 300, setupStacks, false, false},
+		{"rect_walls", PH_BROADPHASE_HASH_GRID, 2 * SPHERE_RADIUS, 2000, 10, 300, setupWalls},
+		// asleep on a static collider that's moved by hand, which has to wake them
+		{"platform_drops", PH_BROADPHASE_HASH_GRID, 2 * SPHERE_RADIUS, 2500, 60, 300, setupPlatform, true, true, false, perstepPlatform},
+		{"sphere_gas_1k", PH_BROADPHASE_ALL_PAIRS, 2 * SPHERE_RADIUS, 1000, 1, 20, setupGas},
+		{"sphere_gas_1k", PH_BROADPHASE_SWEEP_AND_PRUNE, 2 * SPHERE_RADIUS, 1000, 1, 100, setupGas},
+		{"sphere_gas_1k", PH_BROADPHASE_HASH_GRID, 2 * SPHERE_RADIUS, 1000, 1, 100, setupGas},
+		// all-pairs grows with n^2, a few steps is plenty (and at 100k one takes seconds)
+		{"sphere_gas_10k", PH_BROADPHASE_ALL_PAIRS, 2 * SPHERE_RADIUS, 10000, 1, 2, setupGas},
+		{"sphere_gas_10k", PH_BROADPHASE_SWEEP_AND_PRUNE, 2 * SPHERE_RADIUS, 10000, 1, 20, setupGas},
+		{"sphere_gas_10k", PH_BROADPHASE_HASH_GRID, 2 * SPHERE_RADIUS, 10000, 1, 20, setupGas},
+		{"sphere_gas_100k", PH_BROADPHASE_ALL_PAIRS, 2 * SPHERE_RADIUS, 100000, 1, 1, setupGas},
+		{"sphere_gas_100k", PH_BROADPHASE_SWEEP_AND_PRUNE, 2 * SPHERE_RADIUS, 100000, 1, 20, setupGas},
+		{"sphere_gas_100k", PH_BROADPHASE_HASH_GRID, 2 * SPHERE_RADIUS, 100000, 1, 20, setupGas},
+		{"projectile_gas_10k", PH_BROADPHASE_HASH_GRID, 2 * SPHERE_RADIUS, 10000, 1, 20, setupProjectiles},
+		// batched integration against calling update on each collider
+		{"integration_50k", PH_BROADPHASE_NONE, 0, 50000, 1, 200, setupFalling, false},
+		{"integration_50k_per_collider", PH_BROADPHASE_NONE, 0, 50000, 1, 200, setupFalling, false, true, true}
+	};
+	// run again at each thread count, for the pair batches, contact islands and sleep to show how they scale
+	const Scenario threadsweep[] = {
+		{"sphere_rain", PH_BROADPHASE_HASH_GRID, 2 * SPHERE_RADIUS, 10000, 60, 300, setupRain},
+		{"rect_walls", PH_BROADPHASE_HASH_GRID, 2 * SPHERE_RADIUS, 2000, 10, 300, setupWalls},
+		{"sphere_gas_10k", PH_BROADPHASE_HASH_GRID, 2 * SPHERE_RADIUS, 10000, 1, 20, setupGas}
+	};
+
+	fprintf(out, "{\n\t\"threads\": %u,\n\t\"dt\": %f,\n\t\"scenarios\": [\n", numthreads, BENCH_DT);
+	bool first = true;
+	for (const Scenario& s : scenarios) {
+		std::cout << s.name << " (" << broadphasenames[s.broadphase] << ")" << std::endl;
+		runScenario(out, s, numthreads, first);
+		first = false;
+	}
+	for (const Scenario& s : threadsweep) {
+		for (uint8_t nt : {1, 2, 4, 8}) {
+			std::cout << s.name << " (" << broadphasenames[s.broadphase] << ", " << (int)nt << " threads)" << std::endl;
+			runScenario(out, s, nt, first);
+		}
+	}
+	fprintf(out, "\n\t]\n}\n");
+	fclose(out);
+	remove(TERRAIN_PATH);
+
+	return 0;
+}
@@ -21,6 +21,7 @@ void FatalError::raise() {
 	exit(1);
 }
 
+#ifndef VKH_HEADLESS
 void FatalError::vkCatch(VkResult r) {
 	if (r != VK_SUCCESS) {
 		message += "VkResult: "; 
@@ -36,6 +37,7 @@ void FatalError::sdlCatch(bool r) {
 		raise();
 	}
 }
+#endif
 
 /*
  * WarningError
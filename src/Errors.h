@@ -3,8 +3,11 @@
 
 #include <iostream>
 
+// define VKH_HEADLESS to build without Vulkan or SDL, e.g. for examples/physicsbench
+#ifndef VKH_HEADLESS
 #include <vulkan/vk_enum_string_helper.h>
 #include <SDL3/SDL.h>
+#endif
 
 class Error {
 public:
@@ -26,12 +29,14 @@ public:
 	~FatalError() = default;
 
 	void raise();
+#ifndef VKH_HEADLESS
 	// used to raise a FatalError if a vk func fails
 	// for efficiency, should only be used on infrequent (non-per-frame) vk function calls
 	void vkCatch(VkResult r);
 	// vkCatch but for SDL ops. reads SDL_GetError()
 	// cmake got mad at me on linux for using SDL_bool
 	void sdlCatch(bool r);
+#endif
 };
 
 class WarningError : public Error {
@@ -1,12 +1,62 @@
 #include "PhysicsHandler.h"
 
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+uint32_t ColliderStore::add(const ColliderState& s) {
+	p.push_back(s.p);
+	dp.push_back(s.dp);
+	ddp.push_back(s.ddp);
+	lp.push_back(s.lp);
+	m.push_back(s.m);
+	sleeptime.push_back(0);
+	island.push_back(PH_NO_ISLAND);
+	moving.push_back(0);
+	return m.size() - 1;
+}
+
+void ColliderStore::integrate(float dt, uint32_t first, uint32_t last) {
+	if (first >= last) return;
+	memcpy(&lp[first], &p[first], (last - first) * sizeof(glm::vec3));
+	/*
+	 * Every op here is per-component, so the vec3 arrays can be treated as flat float arrays
+	 * and vectorized without caring where one vec3 ends and the next begins.
+	 */
+	float* fp = &p[first].x, * fdp = &dp[first].x;
+	const float* fddp = &ddp[first].x;
+	size_t n = (last - first) * 3, i = 0;
+#ifdef __AVX__
+	__m256 dt8 = _mm256_set1_ps(dt), v8;
+	for (; i + 8 <= n; i += 8) {
+		v8 = _mm256_add_ps(_mm256_loadu_ps(fdp + i), _mm256_mul_ps(_mm256_loadu_ps(fddp + i), dt8));
+		_mm256_storeu_ps(fdp + i, v8);
+		_mm256_storeu_ps(fp + i, _mm256_add_ps(_mm256_loadu_ps(fp + i), _mm256_mul_ps(v8, dt8)));
+	}
+#endif
+#ifdef __SSE2__
+	__m128 dt4 = _mm_set1_ps(dt), v4;
+	for (; i + 4 <= n; i += 4) {
+		v4 = _mm_add_ps(_mm_loadu_ps(fdp + i), _mm_mul_ps(_mm_loadu_ps(fddp + i), dt4));
+		_mm_storeu_ps(fdp + i, v4);
+		_mm_storeu_ps(fp + i, _mm_add_ps(_mm_loadu_ps(fp + i), _mm_mul_ps(v4, dt4)));
+	}
+#endif
+	for (; i < n; i++) {
+		fdp[i] += fddp[i] * dt;
+		fp[i] += fdp[i] * dt;
+	}
+}
+
 void swap(Collider& lhs, Collider& rhs) {
-	std::swap(lhs.p, rhs.p);
-	std::swap(lhs.dp, rhs.dp);
-	std::swap(lhs.ddp, rhs.ddp);
-	std::swap(lhs.lp, rhs.lp);
-	std::swap(lhs.m, rhs.m);
+	// swaps state rather than store handles, so each collider stays wherever it's stored
+	ColliderState ls = lhs.getState();
+	lhs.setState(rhs.getState());
+	rhs.setState(ls);
 	std::swap(lhs.type, rhs.type);
+	std::swap(lhs.layers, rhs.layers);
+	std::swap(lhs.mask, rhs.mask);
+	std::swap(lhs.fast, rhs.fast);
 }
 
 Collider& Collider::operator=(Collider rhs) {
@@ -18,21 +68,26 @@ Collider& Collider::operator=(Collider rhs) {
 }
 
 void Collider::update(float dt) {
-	lp = p;
-	dp += ddp * dt;
+	glm::vec3& p = posRef(), & dp = velRef();
+	lastPosRef() = p;
+	dp += accRef() * dt;
 	p += dp * dt;
 }
 
 void Collider::updateCollision(float dt0, float dt1, glm::vec3 mom) {
+	if (getMass() == std::numeric_limits<float>::infinity()) return;
+	glm::vec3& p = posRef(), & dp = velRef(), & ddp = accRef(), & lp = lastPosRef();
 	// see if you can shove these into dp somehow to avoid allocs
 	glm::vec3 dp0 = (p - lp) / (dt0 + dt1);
 	p = lp + dp0 * dt0;
 
-	dp = mom / m + ddp * (dt0 + dt1);
+	dp = mom / getMass() + ddp * (dt0 + dt1);
 	p += dp * dt1;
 }
 
 void Collider::updateContact(glm::vec3 nf, float dt0, float dt1) {
+	if (getMass() == std::numeric_limits<float>::infinity()) return;
+	glm::vec3& p = posRef(), & dp = velRef(), & ddp = accRef(), & lp = lastPosRef();
 	// TODO: efficiency; redundant normalization of nf
 	glm::vec3 dp0 = (p - lp) / (dt0 + dt1);
 	p = lp + dp0 * dt0;
@@ -44,29 +99,58 @@ void Collider::updateContact(glm::vec3 nf, float dt0, float dt1) {
 }
 
 void Collider::updateSlide(glm::vec3 nm, float dt) {
-	p -= nm * dt;
+	if (getMass() == std::numeric_limits<float>::infinity()) return;
+	posRef() -= nm * dt;
 }
 
 void Collider::applyMomentum(glm::vec3 po) {
+	wake();
+	float m = getMass();
 	if (m == std::numeric_limits<float>::infinity()) return;
 	if (m == 0) return; // idk what to do here, either infinite velocity or none
-	dp += po / m; // should probably have a carve-out for m = 0 or inf
+	velRef() += po / m; // should probably have a carve-out for m = 0 or inf
+}
+
+void Collider::moved() {
+	if (!store) return;
+	store->version++;
+	if (isAsleep()) store->woken.push_back(si);
+	else if (getMass() == std::numeric_limits<float>::infinity()) store->moved.push_back(si);
 }
 
 void Collider::applyForce(glm::vec3 F) {
+	wake();
+	float m = getMass();
 	if (m == std::numeric_limits<float>::infinity()) return;
 	if (m == 0) return; // idk what to do here, either infinite acceleration or none
-	ddp += F / m; // should probably have a carve-out for m = 0 or inf
+	accRef() += F / m; // should probably have a carve-out for m = 0 or inf
 }
 
 glm::vec3 Collider::getMomentum() const {
-	if (m == std::numeric_limits<float>::infinity()) return glm::vec3(0);
-	return dp * m;
+	if (getMass() == std::numeric_limits<float>::infinity()) return glm::vec3(0);
+	return getVel() * getMass();
 }
 
 glm::vec3 Collider::getForce() const {
-	if (m == std::numeric_limits<float>::infinity()) return glm::vec3(0);
-	return ddp * m;
+	if (getMass() == std::numeric_limits<float>::infinity()) return glm::vec3(0);
+	return getAcc() * getMass();
+}
+
+AABB Collider::getBounds() const {
+	return {glm::min(getLastPos(), getPos()), glm::max(getLastPos(), getPos())};
+}
+
+void Collider::setState(const ColliderState& s) {
+	posRef() = s.p;
+	velRef() = s.dp;
+	accRef() = s.ddp;
+	lastPosRef() = s.lp;
+	massRef() = s.m;
+}
+
+void Collider::attach(ColliderStore* s) {
+	si = s->add(getState());
+	store = s;
 }
 
 PointCollider::PointCollider() : Collider() {
@@ -84,6 +168,13 @@ SphereCollider::SphereCollider(float rad) : SphereCollider() {
 	r = rad;
 }
 
+AABB SphereCollider::getBounds() const {
+	AABB res = Collider::getBounds();
+	res.min -= glm::vec3(r);
+	res.max += glm::vec3(r);
+	return res;
+}
+
 OrientedCollider::OrientedCollider() : Collider() {
 #ifdef PH_VERBOSE_COLLIDER_OBJECTS
 	std::cout << this << ": OrientedCollider()" << std::endl;
@@ -110,6 +201,10 @@ OrientedCollider& OrientedCollider::operator=(OrientedCollider rhs) {
 
 void OrientedCollider::update(float dt) {
 	Collider::update(dt);
+	updateOrientation(dt);
+}
+
+void OrientedCollider::updateOrientation(float dt) {
 	// TODO: consider an update that doesn't rely upon TWO SLERPS PER FRAME thats pretty expensive...
 	// see if NLERP is good enough?
 	dr = glm::mix(dr, ddr, dt);
@@ -127,6 +222,7 @@ void OrientedCollider::setRot(glm::quat rot) {
 	 * basically, whatever orientation change needs to happen to make r = rot,
 	 * apply that to dr and ddr too
 	 */
+	moved();
 	r = rot;
 	// dr = dr * (rot - r);
 	/*
@@ -162,13 +258,18 @@ PlaneCollider& PlaneCollider::operator=(PlaneCollider rhs) {
 	return *this;
 }
 
-void PlaneCollider::update(float dt) {
-	OrientedCollider::update(dt);
+void PlaneCollider::updateOrientation(float dt) {
+	OrientedCollider::updateOrientation(dt);
 	// how many ops does this truly save us?
 	// 4 float comps instead of a few multiplications? probably worth it...
 	if (getAngVel() != glm::quat(1, 0, 0, 0)) n = getRot() * glm::vec3(0, 1, 0);
 }
 
+AABB PlaneCollider::getBounds() const {
+	// could be tightened to a slab for axis-aligned normals, but there are rarely enough planes to matter
+	return {glm::vec3(-std::numeric_limits<float>::infinity()), glm::vec3(std::numeric_limits<float>::infinity())};
+}
+
 void PlaneCollider::setNorm(glm::vec3 norm) {
 	// TODO: redo this, not fully correct at all periods
 	n = glm::normalize(norm);
@@ -203,62 +304,51 @@ RectCollider& RectCollider::operator=(RectCollider rhs) {
 	return *this;
 }
 
-MeshCollider::MeshCollider() : Collider(), vertices(nullptr), tris(nullptr), numv(0), numt(0) {
-	type = COLLIDER_TYPE_MESH;
+AABB RectCollider::getBounds() const {
+	AABB res = Collider::getBounds();
+	glm::vec3 e = glm::abs(getRot() * glm::vec3(len.x, 0, 0)) + glm::abs(getRot() * glm::vec3(0, 0, len.y));
+	res.min -= e;
+	res.max += e;
+	return res;
 }
 
-MeshCollider::MeshCollider(const char* f) : MeshCollider() {
+MeshColliderData::MeshColliderData() :
+		vertices(nullptr), 
+		tris(nullptr), 
+		packets(nullptr), 
+		numv(0), 
+		numt(0), 
+		adjoffsets(nullptr), 
+		adj(nullptr), 
+		bounds({glm::vec3(0), glm::vec3(0)}) {}
+
+MeshColliderData::MeshColliderData(const char* f) : MeshColliderData() {
 	loadOBJ(f);
 }
 
-MeshCollider::~MeshCollider() {
-	deleteInnards();
-}
-
-MeshCollider& MeshCollider::operator=(const MeshCollider& rhs) {
-	FatalError("MeshCollider copy assignment not implemented yet lol").raise();
-	Collider::operator=(rhs);
-	deleteInnards();
-	// would have to hook up adjacencies too...
-	memcpy(vertices, rhs.vertices, rhs.numv * sizeof(Vertex));
-	numv = rhs.numv;
-	memcpy(tris, rhs.tris, rhs.numt * sizeof(Tri));
-	return *this;
-}
-
-MeshCollider& MeshCollider::operator=(MeshCollider&& rhs) {
-	Collider::operator=(rhs);
-	std::swap(vertices, rhs.vertices);
-	rhs.vertices = nullptr;
-	std::swap(tris, rhs.tris);
-	rhs.tris = nullptr;
-	std::swap(numv, rhs.numv);
-	rhs.numv = 0;
-	std::swap(numt, rhs.numt);
-	rhs.numt = 0;
-	return *this;
+MeshColliderData::~MeshColliderData() {
+	free(adj);
+	free(adjoffsets);
+	free(packets);
+	free(tris);
+	free(vertices);
 }
 
-void MeshCollider::deleteInnards() {
-	if (tris && numt > 0) {
-		for (size_t ti = 0; ti < numt; ti++) {
-			if (tris[ti].adj && tris[ti].numadj > 0) free(tris[ti].adj);
-		}
-		delete[] tris;
-	}
-	if (vertices && numv > 0) {
-		for (size_t vi = 0; vi < numv; vi++) {
-			if (vertices[vi].t && vertices[vi].numt > 0) delete[] vertices[vi].t;
-		}
-		delete[] vertices;
-	}
+// a few big aligned blocks instead of one allocation per vertex/tri keeps load and teardown cheap
+template<class T>
+static T* allocAligned(size_t n) {
+	if (n == 0) return nullptr;
+	size_t size = (n * sizeof(T) + PH_CACHE_LINE_SIZE - 1) & ~static_cast<size_t>(PH_CACHE_LINE_SIZE - 1);
+	T* res = static_cast<T*>(std::aligned_alloc(PH_CACHE_LINE_SIZE, size));
+	if (!res) FatalError("Couldn't allocate MeshColliderData").raise();
+	return res;
 }
 
 // very similar to code in Mesh.cpp
 // if you change anything over there, check if it should be changed here too!
-void MeshCollider::loadOBJ(const char* fp) {
-	std::vector<unsigned int> vertexindices, uvindices, normalindices;
-	std::vector<Vertex> verticestemp;
+void MeshColliderData::loadOBJ(const char* fp) {
+	std::vector<glm::vec3> verticestemp;
+	std::vector<uint32_t> tritemp;
 	FILE* obj = fopen(fp, "r");
 	if (!obj) FatalError("Couldn't open OBJ file").raise();
 	const int expectedmatches = 3;
@@ -270,14 +360,10 @@ void MeshCollider::loadOBJ(const char* fp) {
 		if (res == EOF) break;
 		if (strcmp(lineheader, "v") == 0) {
 			fscanf(obj, "%f %f %f\n", &vertex.x, &vertex.y, &vertex.z);
-			verticestemp.push_back({vertex, nullptr, 0});
+			verticestemp.push_back(vertex);
 		} 
 		res = fscanf(obj, "%s", lineheader);
 	}
-	numv = verticestemp.size();
-	vertices = new Vertex[numv];
-	memcpy(vertices, verticestemp.data(), numv * sizeof(Vertex));
-	std::vector<Tri> tristemp;
 	while (res != EOF) {
 		if (strcmp(lineheader, "f") == 0) {
 			matches = fscanf(obj, "%d/%*d/%*d %d/%*d/%*d %d/%*d/%*d", &vertidx[0], &vertidx[1], &vertidx[2]);
@@ -285,53 +371,739 @@ void MeshCollider::loadOBJ(const char* fp) {
 				FatalError("Malformed OBJ file").raise();
 				return;
 			}
-			// minus one cuz objs are 1-indexed :/
-			tristemp.push_back({
-				{vertices + vertidx[0] - 1, vertices + vertidx[1] - 1, vertices + vertidx[2] - 1},
-				nullptr, 0
-			});
+			for (uint8_t vi = 0; vi < 3; vi++) {
+				if (vertidx[vi] == 0 || vertidx[vi] > verticestemp.size()) {
+					FatalError("Malformed OBJ file").raise();
+					return;
+				}
+				// minus one cuz objs are 1-indexed :/
+				tritemp.push_back(vertidx[vi] - 1);
+			}
 		}
 		res = fscanf(obj, "%s", lineheader);
 	}
-	numt = tristemp.size();
-	tris = new Tri[numt];
-	memcpy(tris, tristemp.data(), numt * sizeof(Tri));
+	fclose(obj);
+
+	numv = verticestemp.size();
+	if (numv > 0) bounds = {verticestemp[0], verticestemp[0]};
+	vertices = allocAligned<Vertex>(numv);
+	for (size_t vi = 0; vi < numv; vi++) {
+		vertices[vi].p = verticestemp[vi];
+		bounds.min = glm::min(bounds.min, verticestemp[vi]);
+		bounds.max = glm::max(bounds.max, verticestemp[vi]);
+	}
+	numt = tritemp.size() / 3;
+	tris = allocAligned<Tri>(numt);
+	for (size_t ti = 0; ti < numt; ti++) {
+		Tri& t = tris[ti];
+		for (uint8_t vi = 0; vi < 3; vi++) t.v[vi] = vertices + tritemp[3 * ti + vi];
+		for (uint8_t vi = 0; vi < 3; vi++) t.e[vi] = t.v[(vi + 1) % 3]->p - t.v[vi]->p;
+		t.n = glm::normalize(glm::cross(t.e[0], t.e[1]));
+	}
+
+	// tris are in their final (leaf) order after this, so adjacency is built afterwards
+	buildBVH();
 
+	/*
+	 * Two counting-sort passes: first bucket tris by vertex (vertex -> tri CSR), then for each tri
+	 * gather the tris in its vertices' buckets, using a per-tri stamp to drop duplicates.
+	 * Both are linear in the number of tri-vertex incidences.
+	 */
 	for (size_t ti = 0; ti < numt; ti++) {
-		for (uint8_t vi = 0; vi < 3; vi++) {
-			tris[ti].v[vi]->numt++;
-			if (tris[ti].v[vi]->numt == 1) 
-				tris[ti].v[vi]->t = static_cast<Tri**>(malloc(tris[ti].v[vi]->numt * sizeof(Tri*)));
-			else 
-				tris[ti].v[vi]->t = static_cast<Tri**>(realloc(
-					tris[ti].v[vi]->t, 
-					tris[ti].v[vi]->numt * sizeof(Tri*)));
-			tris[ti].v[vi]->t[tris[ti].v[vi]->numt - 1] = &tris[ti];
-		}
-	}
-	std::vector<Tri*> adjtemp;
-	bool unique;
+		for (uint8_t vi = 0; vi < 3; vi++) tritemp[3 * ti + vi] = tris[ti].v[vi] - vertices;
+	}
+	std::vector<uint32_t> vtrioffsets(numv + 1, 0), vtris(tritemp.size());
+	for (uint32_t vi : tritemp) vtrioffsets[vi + 1]++;
+	for (size_t vi = 0; vi < numv; vi++) vtrioffsets[vi + 1] += vtrioffsets[vi];
+	{
+		std::vector<uint32_t> fill(vtrioffsets.begin(), vtrioffsets.end() - 1);
+		for (size_t i = 0; i < tritemp.size(); i++) vtris[fill[tritemp[i]]++] = i / 3;
+	}
+	// first pass counts each tri's neighbors, second fills them in
+	std::vector<uint32_t> stamp(numt, UINT32_MAX);
+	adjoffsets = allocAligned<uint32_t>(numt + 1);
+	adjoffsets[0] = 0;
+	for (uint8_t pass = 0; pass < 2; pass++) {
+		if (pass == 1) {
+			adj = allocAligned<uint32_t>(adjoffsets[numt]);
+			std::fill(stamp.begin(), stamp.end(), UINT32_MAX);
+		}
+		for (uint32_t ti = 0; ti < numt; ti++) {
+			uint32_t n = 0;
+			stamp[ti] = ti;
+			for (uint8_t vi = 0; vi < 3; vi++) {
+				uint32_t v = tritemp[3 * ti + vi];
+				for (uint32_t i = vtrioffsets[v]; i < vtrioffsets[v + 1]; i++) {
+					if (stamp[vtris[i]] == ti) continue;
+					stamp[vtris[i]] = ti;
+					if (pass == 1) adj[adjoffsets[ti] + n] = vtris[i];
+					n++;
+				}
+			}
+			if (pass == 0) adjoffsets[ti + 1] = adjoffsets[ti] + n;
+		}
+	}
+}
+
+static float halfArea(const AABB& b) {
+	glm::vec3 d = b.max - b.min;
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+static void grow(AABB& b, const AABB& o) {
+	b.min = glm::min(b.min, o.min);
+	b.max = glm::max(b.max, o.max);
+}
+
+/*
+ * Top-down binned SAH build, shared by MeshCollider (over tris) and PhysicsQuerySnapshot (over
+ * colliders). Each range of prims is split along the axis of largest centroid extent at whichever bin
+ * boundary minimizes count * area on both sides. The build partitions the compact prims array itself
+ * rather than indices, so afterwards each leaf covers a contiguous run of prims and the caller just
+ * reorders its own data to match prims[].i.
+ */
+static void buildBVHNodes(std::vector<BVHBuildPrim>& prims, std::vector<BVHNode>& nodes, uint32_t leafsize) {
+	nodes.clear();
+	if (prims.empty()) return;
+	nodes.reserve(2 * prims.size() / leafsize + 1);
+
+	typedef struct BuildTask {
+		uint32_t first, numt, parent, depth;
+	} BuildTask;
+	// parent is only set for second children, which have to be patched into their parent's first
+	std::vector<BuildTask> tasks = {{0, static_cast<uint32_t>(prims.size()), UINT32_MAX, 0}};
+	AABB binbounds[PH_BVH_NUM_BINS];
+	uint32_t bincounts[PH_BVH_NUM_BINS];
+	float rightareas[PH_BVH_NUM_BINS];
+	while (!tasks.empty()) {
+		BuildTask task = tasks.back();
+		tasks.pop_back();
+		uint32_t ni = nodes.size();
+		if (task.parent != UINT32_MAX) nodes[task.parent].first = ni;
+
+		BVHBuildPrim* begin = prims.data() + task.first, * end = begin + task.numt;
+		BVHNode node = {begin->b, task.first, task.numt};
+		AABB cb = {begin->c, begin->c};
+		for (BVHBuildPrim* bp = begin + 1; bp < end; bp++) {
+			grow(node.b, bp->b);
+			grow(cb, {bp->c, bp->c});
+		}
+		nodes.push_back(node);
+		if (task.numt <= leafsize || task.depth >= PH_BVH_MAX_DEPTH) continue;
+
+		glm::vec3 extent = cb.max - cb.min;
+		uint8_t axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		uint32_t mid;
+		if (extent[axis] <= 0) {
+			// all centroids coincide, so no plane separates them; just halve the range
+			mid = task.first + task.numt / 2;
+		}
+		else {
+			float scale = PH_BVH_NUM_BINS / extent[axis], lo = cb.min[axis];
+			auto binof = [scale, lo, axis] (const BVHBuildPrim& bp) {
+				return std::min(
+					static_cast<uint32_t>((bp.c[axis] - lo) * scale),
+					static_cast<uint32_t>(PH_BVH_NUM_BINS - 1));
+			};
+			for (uint8_t b = 0; b < PH_BVH_NUM_BINS; b++) bincounts[b] = 0;
+			for (BVHBuildPrim* bp = begin; bp < end; bp++) {
+				uint32_t b = binof(*bp);
+				if (bincounts[b]++ == 0) binbounds[b] = bp->b;
+				else grow(binbounds[b], bp->b);
+			}
+			// sweep from the right to get the area of everything past each boundary
+			AABB acc;
+			uint32_t count = 0;
+			for (uint8_t b = PH_BVH_NUM_BINS - 1; b > 0; b--) {
+				if (bincounts[b]) {
+					if (count == 0) acc = binbounds[b];
+					else grow(acc, binbounds[b]);
+					count += bincounts[b];
+				}
+				rightareas[b] = count ? halfArea(acc) * count : 0;
+			}
+			float bestcost = std::numeric_limits<float>::infinity();
+			uint8_t bestbin = 1;
+			count = 0;
+			for (uint8_t b = 0; b < PH_BVH_NUM_BINS - 1; b++) {
+				if (bincounts[b]) {
+					if (count == 0) acc = binbounds[b];
+					else grow(acc, binbounds[b]);
+					count += bincounts[b];
+				}
+				if (count == 0 || count == task.numt) continue;
+				float cost = halfArea(acc) * count + rightareas[b + 1];
+				if (cost < bestcost) {
+					bestcost = cost;
+					bestbin = b + 1;
+				}
+			}
+			mid = std::partition(begin, end, [&] (const BVHBuildPrim& bp) {return binof(bp) < bestbin;}) - prims.data();
+			if (mid == task.first || mid == task.first + task.numt) mid = task.first + task.numt / 2;
+		}
+
+		nodes[ni].numt = 0;
+		// pushed second so it's built first, right after its parent
+		tasks.push_back({mid, task.first + task.numt - mid, ni, task.depth + 1});
+		tasks.push_back({task.first, mid - task.first, UINT32_MAX, task.depth + 1});
+	}
+}
+
+void MeshColliderData::buildBVH() {
+	bvh.clear();
+	if (numt == 0) return;
+	std::vector<BVHBuildPrim> prims(numt);
 	for (size_t ti = 0; ti < numt; ti++) {
-		adjtemp = std::vector<Tri*>();
-		for (uint8_t vi = 0; vi < 3; vi++) {
-			tris[ti].e[vi] = tris[ti].v[(vi + 1) % 3]->p - tris[ti].v[vi]->p; 
-			for (size_t ati = 0; ati < tris[ti].v[vi]->numt; ati++) {
-				if (&tris[ti] == tris[ti].v[vi]->t[ati]) continue;
-				unique = true;
-				for (Tri* oa : adjtemp) {
-					if (oa == tris[ti].v[vi]->t[ati]) {
-						unique = false;
-						break;
-					}
+		prims[ti].b = {tris[ti].v[0]->p, tris[ti].v[0]->p};
+		for (uint8_t vi = 1; vi < 3; vi++) grow(prims[ti].b, {tris[ti].v[vi]->p, tris[ti].v[vi]->p});
+		prims[ti].c = (prims[ti].b.min + prims[ti].b.max) / 2.f;
+		prims[ti].i = ti;
+	}
+	buildBVHNodes(prims, bvh, PH_BVH_LEAF_SIZE);
+
+	Tri* sorted = allocAligned<Tri>(numt);
+	for (size_t i = 0; i < numt; i++) sorted[i] = tris[prims[i].i];
+	free(tris);
+	tris = sorted;
+	buildPackets();
+}
+
+void MeshColliderData::buildPackets() {
+	free(packets);
+	// padding each leaf out to whole packets means no lane ever belongs to a neighboring leaf
+	leafpackets.assign(bvh.size(), 0);
+	size_t n = 0;
+	for (size_t ni = 0; ni < bvh.size(); ni++) {
+		if (bvh[ni].numt == 0) continue;
+		leafpackets[ni] = n;
+		n += (bvh[ni].numt + PH_TRI_PACKET_SIZE - 1) / PH_TRI_PACKET_SIZE;
+	}
+	packets = allocAligned<TriPacket>(n);
+	if (!packets) return;
+	memset(packets, 0, n * sizeof(TriPacket));
+	for (size_t ni = 0; ni < bvh.size(); ni++) {
+		for (uint32_t j = 0; j < bvh[ni].numt; j++) {
+			TriPacket& tp = packets[leafpackets[ni] + j / PH_TRI_PACKET_SIZE];
+			uint32_t l = j % PH_TRI_PACKET_SIZE;
+			const Tri& tri = tris[bvh[ni].first + j];
+			glm::vec3 e2 = -tri.e[2];
+			for (uint8_t i = 0; i < 3; i++) {
+				tp.v0[i][l] = tri.v[0]->p[i];
+				tp.e0[i][l] = tri.e[0][i];
+				tp.e2[i][l] = e2[i];
+			}
+		}
+	}
+}
+
+// slab test; NaNs from a zero direction component starting on a face are ignored, i.e. count as inside
+static bool segmentHitsAABB(const glm::vec3& p0, const glm::vec3& invd, const AABB& b, float tmax, float& tin, float& tout) {
+	float t0 = 0, t1 = tmax, ta, tb;
+	for (uint8_t i = 0; i < 3; i++) {
+		ta = (b.min[i] - p0[i]) * invd[i];
+		tb = (b.max[i] - p0[i]) * invd[i];
+		if (ta > tb) std::swap(ta, tb);
+		if (ta > t0) t0 = ta;
+		if (tb < t1) t1 = tb;
+		if (t0 > t1) return false;
+	}
+	tin = t0;
+	tout = t1;
+	return true;
+}
+
+static bool segmentHitsAABB(const glm::vec3& p0, const glm::vec3& invd, const AABB& b, float tmax, float& tin) {
+	float tout;
+	return segmentHitsAABB(p0, invd, b, tmax, tin, tout);
+}
+
+static bool segmentHitsAABB(const glm::vec3& p0, const glm::vec3& invd, const AABB& b, float tmax) {
+	float tin;
+	return segmentHitsAABB(p0, invd, b, tmax, tin);
+}
+
+static AABB padded(const AABB& b, float r) {
+	return {b.min - glm::vec3(r), b.max + glm::vec3(r)};
+}
+
+static bool sphereHitsAABB(const glm::vec3& c, float r, const AABB& b) {
+	glm::vec3 d = c - glm::max(b.min, glm::min(c, b.max));
+	return glm::dot(d, d) <= r * r;
+}
+
+// distance along the unit d to where a ray from o first touches the sphere, 0 if it starts inside
+static bool raySphere(const glm::vec3& o, const glm::vec3& d, const glm::vec3& c, float r, float maxt, float& t) {
+	glm::vec3 m = o - c;
+	float b = glm::dot(m, d), cc = glm::dot(m, m) - r * r;
+	if (cc <= 0) {
+		t = 0;
+		return true;
+	}
+	if (b > 0) return false;
+	float disc = b * b - cc;
+	if (disc < 0) return false;
+	t = -b - sqrtf(disc);
+	return t <= maxt;
+}
+
+// Ericson's closest point on triangle abc to p, by Voronoi region
+static glm::vec3 closestOnTri(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+	glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+	float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+	if (d1 <= 0 && d2 <= 0) return a;
+	glm::vec3 bp = p - b;
+	float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+	if (d3 >= 0 && d4 <= d3) return b;
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0 && d1 >= 0 && d3 <= 0) return a + ab * (d1 / (d1 - d3));
+	glm::vec3 cp = p - c;
+	float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+	if (d6 >= 0 && d5 <= d6) return c;
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0 && d2 >= 0 && d6 <= 0) return a + ac * (d2 / (d2 - d6));
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) return b + (c - b) * ((d4 - d3) / (d4 - d3 + d5 - d6));
+	float denom = 1 / (va + vb + vc);
+	return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+/*
+ * Sphere of radius r swept from o along the unit d against triangle abc (unit normal tn), from either
+ * side. It's a ray against the tri thickened by r: first the two offset faces, then, if those are
+ * missed, the capsules around the edges and spheres around the corners.
+ */
+static bool sweepSphereTri(const glm::vec3& o, const glm::vec3& d, float r, const glm::vec3& a, const glm::vec3& b, 
+		const glm::vec3& c, const glm::vec3& tn, float maxt, float& t, glm::vec3& n) {
+	if (r > 0) {
+		glm::vec3 oc = o - closestOnTri(o, a, b, c);
+		float dist2 = glm::dot(oc, oc);
+		if (dist2 <= r * r) {
+			t = 0;
+			n = dist2 > 0 ? oc / sqrtf(dist2) : (glm::dot(o - a, tn) >= 0 ? tn : -tn);
+			return true;
+		}
+	}
+	float dist = glm::dot(o - a, tn), dn = glm::dot(d, tn), side = dist >= 0 ? 1 : -1, tt;
+	if (dn * side < 0) {
+		tt = (side * r - dist) / dn;
+		if (tt >= 0 && tt <= maxt) {
+			glm::vec3 q = o + d * tt - tn * (side * r);
+			if (glm::dot(glm::cross(b - a, q - a), tn) >= 0
+				&& glm::dot(glm::cross(c - b, q - b), tn) >= 0
+				&& glm::dot(glm::cross(a - c, q - c), tn) >= 0) {
+				t = tt;
+				n = tn * side;
+				return true;
+			}
+		}
+	}
+	if (r == 0) return false;
+
+	bool hit = false;
+	const glm::vec3* vs[3] = {&a, &b, &c};
+	glm::vec3 e, m;
+	float ee, ed, em, A, B, C, disc, s;
+	for (uint8_t i = 0; i < 3; i++) {
+		const glm::vec3& p0 = *vs[i], & p1 = *vs[(i + 1) % 3];
+		// infinite cylinder around the edge, then clamped to it
+		e = p1 - p0;
+		m = o - p0;
+		ee = glm::dot(e, e);
+		ed = glm::dot(e, d);
+		em = glm::dot(e, m);
+		A = ee - ed * ed;
+		// parallel to the edge, so the corners get there first
+		if (A <= 1e-6f * ee) continue;
+		B = ee * glm::dot(m, d) - em * ed;
+		C = ee * (glm::dot(m, m) - r * r) - em * em;
+		disc = B * B - A * C;
+		if (disc < 0) continue;
+		tt = (-B - sqrtf(disc)) / A;
+		if (tt < 0 || tt > maxt) continue;
+		s = (em + tt * ed) / ee;
+		if (s < 0 || s > 1) continue;
+		maxt = tt;
+		n = glm::normalize(o + d * tt - (p0 + e * s));
+		hit = true;
+	}
+	for (uint8_t i = 0; i < 3; i++) {
+		if (!raySphere(o, d, *vs[i], r, maxt, tt)) continue;
+		maxt = tt;
+		n = glm::normalize(o + d * tt - *vs[i]);
+		hit = true;
+	}
+	if (hit) t = maxt;
+	return hit;
+}
+
+/*
+ * Moller-Trumbore against every tri in a packet at once. Bit i is set if tri i is crossed by the
+ * segment p0 -> p0 + d with t[i] in [0, 1]. Arithmetic is in the same order as glm's cross and dot,
+ * so short of FMA contraction the answers match testing the tris one at a time.
+ */
+static uint32_t segmentTriPacket(const TriPacket& tp, const glm::vec3& p0, const glm::vec3& d, bool cullback, float* t) {
+	uint32_t res = 0;
+	uint32_t i = 0;
+#ifdef __SSE2__
+	__m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1);
+	__m128 dx = _mm_set1_ps(d.x), dy = _mm_set1_ps(d.y), dz = _mm_set1_ps(d.z);
+	for (; i + 4 <= PH_TRI_PACKET_SIZE; i += 4) {
+		__m128 e0x = _mm_load_ps(tp.e0[0] + i), e0y = _mm_load_ps(tp.e0[1] + i), e0z = _mm_load_ps(tp.e0[2] + i),
+		       e2x = _mm_load_ps(tp.e2[0] + i), e2y = _mm_load_ps(tp.e2[1] + i), e2z = _mm_load_ps(tp.e2[2] + i);
+		// pv = cross(d, e2)
+		__m128 pvx = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(e2y, dz)),
+		       pvy = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(e2z, dx)),
+		       pvz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(e2x, dy));
+		__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e0x, pvx), _mm_mul_ps(e0y, pvy)), _mm_mul_ps(e0z, pvz));
+		// det > 0 means d opposes the CCW normal
+		__m128 miss = cullback ? _mm_cmple_ps(det, zero) : _mm_cmpeq_ps(det, zero);
+		__m128 sx = _mm_sub_ps(_mm_set1_ps(p0.x), _mm_load_ps(tp.v0[0] + i)),
+		       sy = _mm_sub_ps(_mm_set1_ps(p0.y), _mm_load_ps(tp.v0[1] + i)),
+		       sz = _mm_sub_ps(_mm_set1_ps(p0.z), _mm_load_ps(tp.v0[2] + i));
+		__m128 u = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, pvx), _mm_mul_ps(sy, pvy)), _mm_mul_ps(sz, pvz)), det);
+		miss = _mm_or_ps(miss, _mm_or_ps(_mm_cmplt_ps(u, zero), _mm_cmpgt_ps(u, one)));
+		// q = cross(s, e0)
+		__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e0z), _mm_mul_ps(e0y, sz)),
+		       qy = _mm_sub_ps(_mm_mul_ps(sz, e0x), _mm_mul_ps(e0z, sx)),
+		       qz = _mm_sub_ps(_mm_mul_ps(sx, e0y), _mm_mul_ps(e0x, sy));
+		__m128 v = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), det);
+		miss = _mm_or_ps(miss, _mm_or_ps(_mm_cmplt_ps(v, zero), _mm_cmpgt_ps(_mm_add_ps(u, v), one)));
+		__m128 tt = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), det);
+		miss = _mm_or_ps(miss, _mm_or_ps(_mm_cmplt_ps(tt, zero), _mm_cmpgt_ps(tt, one)));
+		_mm_storeu_ps(t + i, tt);
+		res |= (uint32_t)(~_mm_movemask_ps(miss) & 0xf) << i;
+	}
+#endif
+	glm::vec3 e0, e2, pv, s, q;
+	float det, u, v;
+	for (; i < PH_TRI_PACKET_SIZE; i++) {
+		e0 = glm::vec3(tp.e0[0][i], tp.e0[1][i], tp.e0[2][i]);
+		e2 = glm::vec3(tp.e2[0][i], tp.e2[1][i], tp.e2[2][i]);
+		pv = glm::cross(d, e2);
+		det = glm::dot(e0, pv);
+		if (cullback ? det <= 0 : det == 0) continue;
+		s = p0 - glm::vec3(tp.v0[0][i], tp.v0[1][i], tp.v0[2][i]);
+		u = glm::dot(s, pv) / det;
+		if (u < 0 || u > 1) continue;
+		q = glm::cross(s, e0);
+		v = glm::dot(d, q) / det;
+		if (v < 0 || u + v > 1) continue;
+		t[i] = glm::dot(e2, q) / det;
+		if (t[i] < 0 || t[i] > 1) continue;
+		res |= 1u << i;
+	}
+	return res;
+}
+
+const Tri* MeshColliderData::intersectSegment(const glm::vec3& p0, const glm::vec3& p1, float& t, bool cullback
+#ifdef PH_STATS
+	, uint32_t* numtested
+#endif
+	) const {
+	static_assert(PH_TRI_PACKET_SIZE <= 32);
+	const Tri* res = nullptr;
+	t = 1;
+	if (bvh.empty()) return res;
+	glm::vec3 d = p1 - p0, invd = 1.f / d;
+	float tt[PH_TRI_PACKET_SIZE];
+	uint32_t hits;
+	uint32_t stack[PH_BVH_MAX_DEPTH + 2];
+	uint8_t sp = 0;
+	stack[sp++] = 0;
+	while (sp > 0) {
+		uint32_t ni = stack[--sp];
+		const BVHNode& node = bvh[ni];
+		if (!segmentHitsAABB(p0, invd, node.b, t)) continue;
+		if (node.numt == 0) {
+			stack[sp++] = node.first;
+			stack[sp++] = ni + 1;
+			continue;
+		}
+#ifdef PH_STATS
+		if (numtested) *numtested += node.numt;
+#endif
+		for (uint32_t k = 0; k * PH_TRI_PACKET_SIZE < node.numt; k++) {
+			hits = segmentTriPacket(packets[leafpackets[ni] + k], p0, d, cullback, tt);
+			while (hits) {
+				uint32_t l = std::countr_zero(hits);
+				hits &= hits - 1;
+				// in tri order, so ties go to the last tri as they would one at a time
+				if (tt[l] > t) continue;
+				t = tt[l];
+				res = tris + node.first + k * PH_TRI_PACKET_SIZE + l;
+			}
+		}
+	}
+	return res;
+}
+
+const Tri* MeshColliderData::sweepSphere(const glm::vec3& o, const glm::vec3& d, float r, float maxt, float& t, glm::vec3& n) const {
+	const Tri* res = nullptr;
+	t = maxt;
+	if (bvh.empty()) return res;
+	glm::vec3 invd = 1.f / d, tn;
+	float tt;
+	uint32_t stack[PH_BVH_MAX_DEPTH + 2];
+	uint8_t sp = 0;
+	stack[sp++] = 0;
+	while (sp > 0) {
+		uint32_t ni = stack[--sp];
+		const BVHNode& node = bvh[ni];
+		if (!segmentHitsAABB(o, invd, padded(node.b, r), t)) continue;
+		if (node.numt == 0) {
+			stack[sp++] = node.first;
+			stack[sp++] = ni + 1;
+			continue;
+		}
+		for (uint32_t i = node.first; i < node.first + node.numt; i++) {
+			const Tri& tri = tris[i];
+			if (!sweepSphereTri(o, d, r, tri.v[0]->p, tri.v[1]->p, tri.v[2]->p, tri.n, t, tt, tn)) continue;
+			t = tt;
+			n = tn;
+			res = &tri;
+		}
+	}
+	return res;
+}
+
+bool MeshColliderData::overlapsSphere(const glm::vec3& c, float r) const {
+	if (bvh.empty()) return false;
+	glm::vec3 d;
+	uint32_t stack[PH_BVH_MAX_DEPTH + 2];
+	uint8_t sp = 0;
+	stack[sp++] = 0;
+	while (sp > 0) {
+		uint32_t ni = stack[--sp];
+		const BVHNode& node = bvh[ni];
+		if (!sphereHitsAABB(c, r, node.b)) continue;
+		if (node.numt == 0) {
+			stack[sp++] = node.first;
+			stack[sp++] = ni + 1;
+			continue;
+		}
+		for (uint32_t i = node.first; i < node.first + node.numt; i++) {
+			d = c - closestOnTri(c, tris[i].v[0]->p, tris[i].v[1]->p, tris[i].v[2]->p);
+			if (glm::dot(d, d) <= r * r) return true;
+		}
+	}
+	return false;
+}
+
+MeshCollider::MeshCollider() : MeshCollider(std::make_shared<const MeshColliderData>()) {}
+
+MeshCollider::MeshCollider(const char* f) : MeshCollider(std::make_shared<const MeshColliderData>(f)) {}
+
+MeshCollider::MeshCollider(std::shared_ptr<const MeshColliderData> d) : OrientedCollider(), data(std::move(d)) {
+	type = COLLIDER_TYPE_MESH;
+}
+
+MeshCollider& MeshCollider::operator=(MeshCollider rhs) {
+	OrientedCollider::operator=(rhs);
+	std::swap(data, rhs.data);
+	return *this;
+}
+
+AABB MeshCollider::getBounds() const {
+	AABB res = Collider::getBounds(), b = data->getBounds();
+	glm::vec3 c = getRot() * ((b.min + b.max) / 2.f), h = (b.max - b.min) / 2.f,
+		e = glm::abs(getRot() * glm::vec3(h.x, 0, 0)) + glm::abs(getRot() * glm::vec3(0, h.y, 0)) + glm::abs(getRot() * glm::vec3(0, 0, h.z));
+	res.min += c - e;
+	res.max += c + e;
+	return res;
+}
+
+const Tri* MeshCollider::intersectSegment(const glm::vec3& p0, const glm::vec3& p1, float& t, bool cullback) const {
+	return data->intersectSegment(toLocal(p0), toLocal(p1), t, cullback);
+}
+
+const Tri* MeshCollider::sweepSphere(const glm::vec3& o, const glm::vec3& d, float r, float maxt, float& t, glm::vec3& n) const {
+	const Tri* res = data->sweepSphere(toLocal(o), glm::inverse(getRot()) * d, r, maxt, t, n);
+	if (res) n = getRot() * n;
+	return res;
+}
+
+bool MeshCollider::overlapsSphere(const glm::vec3& c, float r) const {
+	return data->overlapsSphere(toLocal(c), r);
+}
+
+HeightfieldCollider::HeightfieldCollider() :
+		Collider(),
+		w(0),
+		d(0),
+		spacing(1),
+		heightscale(1),
+		minsample(0),
+		maxsample(0) {
+	type = COLLIDER_TYPE_HEIGHTFIELD;
+}
+
+HeightfieldCollider::HeightfieldCollider(uint32_t w, uint32_t d, float spacing, float heightscale, std::vector<uint16_t>&& s) : HeightfieldCollider() {
+	if (s.size() != (size_t)w * d) FatalError("Heightfield sample count doesn't match its size").raise();
+	this->w = w;
+	this->d = d;
+	this->spacing = spacing;
+	this->heightscale = heightscale;
+	samples = std::move(s);
+	findRange();
+}
+
+HeightfieldCollider::HeightfieldCollider(const char* f, float spacing, float heightscale) : HeightfieldCollider() {
+	this->spacing = spacing;
+	this->heightscale = heightscale;
+	loadPNG(f);
+	findRange();
+}
+
+HeightfieldCollider& HeightfieldCollider::operator=(HeightfieldCollider rhs) {
+	Collider::operator=(rhs);
+	std::swap(w, rhs.w);
+	std::swap(d, rhs.d);
+	std::swap(spacing, rhs.spacing);
+	std::swap(heightscale, rhs.heightscale);
+	std::swap(minsample, rhs.minsample);
+	std::swap(maxsample, rhs.maxsample);
+	std::swap(samples, rhs.samples);
+	return *this;
+}
+
+void HeightfieldCollider::loadPNG(const char* fp) {
+	png_image i;
+	memset(&i, 0, sizeof(png_image));
+	i.version = PNG_IMAGE_VERSION;
+	if (!png_image_begin_read_from_file(&i, fp)) FatalError("Couldn't open heightfield PNG").raise();
+	// 8-bit files get converted from sRGB on the way in, which bends the heights
+	if (!(i.format & PNG_FORMAT_FLAG_LINEAR)) WarningError("Heightfield PNG isn't 16-bit").raise();
+	i.format = PNG_FORMAT_LINEAR_Y;
+	samples.resize((size_t)i.width * i.height);
+	if (!png_image_finish_read(&i, NULL, samples.data(), 0, NULL)) FatalError("Couldn't read heightfield PNG").raise();
+	w = i.width;
+	d = i.height;
+	png_image_free(&i);
+}
+
+void HeightfieldCollider::findRange() {
+	if (w < 2 || d < 2) FatalError("Heightfield needs at least 2x2 samples").raise();
+	auto [mn, mx] = std::minmax_element(samples.begin(), samples.end());
+	minsample = *mn;
+	maxsample = *mx;
+}
+
+void HeightfieldCollider::getCell(uint32_t i, uint32_t j, glm::vec3 v[4]) const {
+	const uint16_t* s = samples.data() + j * w + i;
+	v[0] = glm::vec3(i * spacing, s[0] * heightscale, j * spacing);
+	v[1] = glm::vec3((i + 1) * spacing, s[1] * heightscale, j * spacing);
+	v[2] = glm::vec3(i * spacing, s[w] * heightscale, (j + 1) * spacing);
+	v[3] = glm::vec3((i + 1) * spacing, s[w + 1] * heightscale, (j + 1) * spacing);
+}
+
+bool HeightfieldCollider::getHeight(float x, float z, float& h, glm::vec3& n) const {
+	float lx = (x - getPos().x) / spacing, lz = (z - getPos().z) / spacing;
+	if (!(lx >= 0 && lz >= 0 && lx <= w - 1 && lz <= d - 1)) return false;
+	uint32_t i = std::min((uint32_t)lx, w - 2), j = std::min((uint32_t)lz, d - 2);
+	float fx = lx - i, fz = lz - j;
+	glm::vec3 v[4];
+	getCell(i, j, v);
+	// the two tris are 0 2 3 (fz >= fx) and 0 3 1, both CCW seen from above
+	glm::vec3 e0 = fz >= fx ? v[2] - v[0] : v[3] - v[0], e1 = fz >= fx ? v[3] - v[0] : v[1] - v[0];
+	n = glm::normalize(glm::cross(e0, e1));
+	h = fz >= fx ? v[0].y + (v[3].y - v[2].y) * fx + (v[2].y - v[0].y) * fz
+		: v[0].y + (v[1].y - v[0].y) * fx + (v[3].y - v[1].y) * fz;
+	h += getPos().y;
+	return true;
+}
+
+bool HeightfieldCollider::closestPoint(const glm::vec3& c, float r, glm::vec3& q, glm::vec3& n) const {
+	glm::vec3 l = c - getPos(), v[4], cq;
+	if (l.y - r > maxsample * heightscale) return false;
+	float h;
+	if (getHeight(c.x, c.z, h, n) && c.y < h) {
+		q = glm::vec3(c.x, h, c.z);
+		return true;
+	}
+	// only the cells under the sphere's footprint
+	int64_t i0 = std::max<int64_t>(floorf((l.x - r) / spacing), 0), i1 = std::min<int64_t>(floorf((l.x + r) / spacing), w - 2),
+		j0 = std::max<int64_t>(floorf((l.z - r) / spacing), 0), j1 = std::min<int64_t>(floorf((l.z + r) / spacing), d - 2);
+	float best = r * r, dist2;
+	bool res = false;
+	for (int64_t j = j0; j <= j1; j++) {
+		for (int64_t i = i0; i <= i1; i++) {
+			getCell(i, j, v);
+			for (uint8_t ti = 0; ti < 2; ti++) {
+				cq = ti == 0 ? closestOnTri(l, v[0], v[2], v[3]) : closestOnTri(l, v[0], v[3], v[1]);
+				dist2 = glm::dot(l - cq, l - cq);
+				if (dist2 > best) continue;
+				best = dist2;
+				q = cq;
+				res = true;
+			}
+		}
+	}
+	if (!res) return false;
+	if (best > 0) n = (l - q) / sqrtf(best);
+	else getHeight(c.x, c.z, h, n);
+	q += getPos();
+	return true;
+}
+
+bool HeightfieldCollider::overlapsSphere(const glm::vec3& c, float r) const {
+	glm::vec3 q, n;
+	return closestPoint(c, r, q, n);
+}
+
+bool HeightfieldCollider::sweepSphere(const glm::vec3& o, const glm::vec3& dir, float r, float maxt, float& t, glm::vec3& n) const {
+	glm::vec3 l = o - getPos(), invd = 1.f / dir, v[4], tn;
+	AABB b = {glm::vec3(0, minsample * heightscale, 0), glm::vec3((w - 1) * spacing, maxsample * heightscale, (d - 1) * spacing)};
+	float tin, tout, tt;
+	if (!segmentHitsAABB(l, invd, padded(b, r), maxt, tin, tout)) return false;
+	/*
+	 * 2D DDA over the cells the center passes over, from where it enters the (padded) bounds. A tri hit
+	 * at some t is within r of the center's cell then, so testing every cell within k of each visited
+	 * one finds it, and nothing can be hit before a visited cell's entry.
+	 */
+	int64_t k = ceilf(r / spacing), ci, cj;
+	glm::vec3 start = l + dir * tin;
+	ci = floorf(start.x / spacing);
+	cj = floorf(start.z / spacing);
+	int64_t stepi = dir.x > 0 ? 1 : -1, stepj = dir.z > 0 ? 1 : -1;
+	float nexti = dir.x == 0 ? std::numeric_limits<float>::infinity() : ((ci + (stepi > 0)) * spacing - l.x) * invd.x,
+	      nextj = dir.z == 0 ? std::numeric_limits<float>::infinity() : ((cj + (stepj > 0)) * spacing - l.z) * invd.z,
+	      deltai = dir.x == 0 ? std::numeric_limits<float>::infinity() : spacing * abs(invd.x),
+	      deltaj = dir.z == 0 ? std::numeric_limits<float>::infinity() : spacing * abs(invd.z),
+	      entry = tin;
+	bool hit = false;
+	t = tout;
+	while (entry <= t) {
+		for (int64_t j = std::max<int64_t>(cj - k, 0); j <= std::min<int64_t>(cj + k, d - 2); j++) {
+			for (int64_t i = std::max<int64_t>(ci - k, 0); i <= std::min<int64_t>(ci + k, w - 2); i++) {
+				getCell(i, j, v);
+				for (uint8_t ti = 0; ti < 2; ti++) {
+					const glm::vec3& a = v[0], & bb = ti == 0 ? v[2] : v[3], & c = ti == 0 ? v[3] : v[1];
+					if (!sweepSphereTri(l, dir, r, a, bb, c, glm::normalize(glm::cross(bb - a, c - a)), t, tt, tn)) continue;
+					t = tt;
+					n = tn;
+					hit = true;
 				}
-				if (unique) adjtemp.push_back(tris[ti].v[vi]->t[ati]);
 			}
 		}
-		tris[ti].numadj = adjtemp.size();
-		tris[ti].adj = new Tri*[tris[ti].numadj];
-		memcpy(tris[ti].adj, adjtemp.data(), tris[ti].numadj * sizeof(Tri*));
-		tris[ti].n = glm::normalize(glm::cross(tris[ti].e[0], tris[ti].e[1]));
+		if (nexti < nextj) {
+			entry = nexti;
+			nexti += deltai;
+			ci += stepi;
+		}
+		else {
+			entry = nextj;
+			nextj += deltaj;
+			cj += stepj;
+		}
 	}
+	return hit;
+}
+
+AABB HeightfieldCollider::getBounds() const {
+	AABB res = Collider::getBounds();
+	res.min.y += minsample * heightscale;
+	res.max += glm::vec3((w - 1) * spacing, maxsample * heightscale, (d - 1) * spacing);
+	return res;
 }
 
 ColliderPair::ColliderPair(Collider* col1, Collider* col2) : ColliderPair() {
@@ -343,12 +1115,13 @@ ColliderPair::ColliderPair(Collider* col1, Collider* col2) : ColliderPair() {
 ColliderPair& ColliderPair::operator=(ColliderPair rhs) {
 	std::swap(c1, rhs.c1);
 	std::swap(c2, rhs.c2);
-	std::swap(cf, rhs.cf);
+	std::swap(kernel, rhs.kernel);
 	std::swap(nearest, rhs.nearest);
 	std::swap(nf, rhs.nf);
 	std::swap(reldp, rhs.reldp);
 	std::swap(lreldp, rhs.lreldp);
 	std::swap(dynf, rhs.dynf);
+	std::swap(manifold, rhs.manifold);
 	std::swap(oncollide, rhs.oncollide);
 	std::swap(oncouple, rhs.oncouple);
 	std::swap(ondecouple, rhs.ondecouple);
@@ -357,73 +1130,197 @@ ColliderPair& ColliderPair::operator=(ColliderPair rhs) {
 	return *this;
 }
 
-void ColliderPair::setCollisionFunc() {
-	cf = nullptr;
-	if (c1->getType() == COLLIDER_TYPE_POINT) {
-		if (c2->getType() == COLLIDER_TYPE_PLANE) {
-			cf = &ColliderPair::collidePointPlane;
-		}
-		else if (c2->getType() == COLLIDER_TYPE_RECT) {
-			cf = &ColliderPair::collidePointRect;
-		}
-		else if (c2->getType() == COLLIDER_TYPE_MESH) {
-			nearest = static_cast<const Tri*>(static_cast<MeshCollider*>(c2)->getTris());
-			cf = &ColliderPair::collidePointMesh;
-		}
+template <> constexpr ColliderPair::CollisionFunc ColliderPair::collisionKernel<COLLIDER_TYPE_POINT, COLLIDER_TYPE_PLANE>() {return &ColliderPair::collidePointPlane;}
+template <> constexpr ColliderPair::CollisionFunc ColliderPair::collisionKernel<COLLIDER_TYPE_POINT, COLLIDER_TYPE_RECT>() {return &ColliderPair::collidePointRect;}
+template <> constexpr ColliderPair::CollisionFunc ColliderPair::collisionKernel<COLLIDER_TYPE_POINT, COLLIDER_TYPE_MESH>() {return &ColliderPair::collidePointMesh;}
+template <> constexpr ColliderPair::CollisionFunc ColliderPair::collisionKernel<COLLIDER_TYPE_POINT, COLLIDER_TYPE_HEIGHTFIELD>() {return &ColliderPair::collidePointHeightfield;}
+template <> constexpr ColliderPair::CollisionFunc ColliderPair::collisionKernel<COLLIDER_TYPE_SPHERE, COLLIDER_TYPE_SPHERE>() {return &ColliderPair::collideSphereSphere;}
+template <> constexpr ColliderPair::CollisionFunc ColliderPair::collisionKernel<COLLIDER_TYPE_SPHERE, COLLIDER_TYPE_PLANE>() {return &ColliderPair::collideSpherePlane;}
+template <> constexpr ColliderPair::CollisionFunc ColliderPair::collisionKernel<COLLIDER_TYPE_SPHERE, COLLIDER_TYPE_RECT>() {return &ColliderPair::collideSphereRect;}
+template <> constexpr ColliderPair::CollisionFunc ColliderPair::collisionKernel<COLLIDER_TYPE_SPHERE, COLLIDER_TYPE_HEIGHTFIELD>() {return &ColliderPair::collideSphereHeightfield;}
+
+template <ColliderType T1, ColliderType T2> constexpr ColliderPair::CollisionDispatch ColliderPair::dispatchEntry() {
+	if constexpr (collisionKernel<T1, T2>() != nullptr) return {collisionKernel<T1, T2>(), &checkBucket<collisionKernel<T1, T2>()>, false};
+	else if constexpr (collisionKernel<T2, T1>() != nullptr) return {collisionKernel<T2, T1>(), &checkBucket<collisionKernel<T2, T1>()>, true};
+	else return {};
+}
+
+template <size_t... I> constexpr std::array<ColliderPair::CollisionDispatch, sizeof...(I)> ColliderPair::makeDispatchTable(std::index_sequence<I...>) {
+	return {dispatchEntry<ColliderType(I / COLLIDER_TYPE_COUNT), ColliderType(I % COLLIDER_TYPE_COUNT)>()...};
+}
+
+const ColliderPair::CollisionDispatch& ColliderPair::getDispatch(uint8_t k) {
+	static_assert(COLLIDER_TYPE_COUNT * COLLIDER_TYPE_COUNT <= UINT8_MAX + 1);
+	static constexpr std::array<CollisionDispatch, COLLIDER_TYPE_COUNT * COLLIDER_TYPE_COUNT> table 
+		= makeDispatchTable(std::make_index_sequence<COLLIDER_TYPE_COUNT * COLLIDER_TYPE_COUNT>());
+	return table[k];
+}
+
+template <ColliderPair::CollisionFunc F> void ColliderPair::checkBucket(ColliderPair* const* ps, size_t n, float dt, std::vector<PhysicsEvent>& ev) {
+	if constexpr (F == &ColliderPair::collideSpherePlane || F == &ColliderPair::collideSphereRect) {
+		checkSphereStaticBucket<F>(ps, n, dt, ev);
+		return;
 	}
-	if (c1->getType() == COLLIDER_TYPE_SPHERE) {
-		if (c2->getType() == COLLIDER_TYPE_SPHERE) {
-			cf = &ColliderPair::collideSphereSphere;
-		}
-		else if (c2->getType() == COLLIDER_TYPE_PLANE) {
-			cf = &ColliderPair::collideSpherePlane;
-		}
-		else if (c2->getType() == COLLIDER_TYPE_RECT) {
-			cf = &ColliderPair::collideSphereRect;
-		}
+	ColliderPair* p;
+	for (size_t i = 0; i < n; i++) {
+		p = ps[i];
+		p->events = &ev;
+		p->prepareCheck();
+		(p->*F)(dt);
+		p->events = nullptr;
 	}
-	// TODO: test this swapping tec
-	else if (c1->getType() == COLLIDER_TYPE_PLANE) {
-		if (c2->getType() == COLLIDER_TYPE_POINT) {
-			std::swap(c1, c2);
-			cf = &ColliderPair::collidePointPlane;
-		}
-		else if (c2->getType() == COLLIDER_TYPE_SPHERE) {
-			std::swap(c1, c2);
-			cf = &ColliderPair::collideSpherePlane;
+}
+
+// one screen's worth of sphere-plane/rect pairs, laid out for SIMD
+typedef struct SphereStaticScreen {
+	// sphere's last and current positions relative to the wall's
+	alignas(32) float x0[PH_SCREEN_WIDTH], y0[PH_SCREEN_WIDTH], z0[PH_SCREEN_WIDTH];
+	alignas(32) float x1[PH_SCREEN_WIDTH], y1[PH_SCREEN_WIDTH], z1[PH_SCREEN_WIDTH];
+	alignas(32) float nx[PH_SCREEN_WIDTH], ny[PH_SCREEN_WIDTH], nz[PH_SCREEN_WIDTH];
+	alignas(32) float r[PH_SCREEN_WIDTH];
+} SphereStaticScreen;
+
+/*
+ * Bit i is set if pair i might collide: approaching the wall with its center in front and ending up
+ * less than r from it. For rects, also if it might raise an anticollide, unclip, or antiunclip event.
+ * All with PH_SCREEN_MARGIN to spare, so anything the collision functions would act on gets through.
+ */
+static uint32_t screenSphereStatic(const SphereStaticScreen& s, bool rect) {
+	uint32_t res = 0;
+	uint32_t i = 0;
+#ifdef __AVX__
+	__m256 m8 = _mm256_set1_ps(PH_SCREEN_MARGIN), sign8 = _mm256_set1_ps(-0.f);
+	for (; i + 8 <= PH_SCREEN_WIDTH; i += 8) {
+		__m256 nx = _mm256_load_ps(s.nx + i), ny = _mm256_load_ps(s.ny + i), nz = _mm256_load_ps(s.nz + i), r = _mm256_load_ps(s.r + i);
+		__m256 d0 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(s.x0 + i), nx), _mm256_mul_ps(_mm256_load_ps(s.y0 + i), ny)), _mm256_mul_ps(_mm256_load_ps(s.z0 + i), nz)),
+		       d1 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(s.x1 + i), nx), _mm256_mul_ps(_mm256_load_ps(s.y1 + i), ny)), _mm256_mul_ps(_mm256_load_ps(s.z1 + i), nz));
+		__m256 rpm = _mm256_add_ps(r, m8), rmm = _mm256_sub_ps(r, m8);
+		__m256 hit = _mm256_and_ps(_mm256_and_ps(
+			_mm256_cmp_ps(d0, _mm256_xor_ps(m8, sign8), _CMP_GT_OQ),
+			_mm256_cmp_ps(d1, rpm, _CMP_LT_OQ)),
+			_mm256_cmp_ps(_mm256_sub_ps(d1, d0), m8, _CMP_LT_OQ));
+		if (rect) {
+			__m256 nrpm = _mm256_xor_ps(rpm, sign8), nrmm = _mm256_xor_ps(rmm, sign8);
+			__m256 anti = _mm256_and_ps(_mm256_cmp_ps(d0, nrmm, _CMP_LT_OQ), _mm256_cmp_ps(d1, nrpm, _CMP_GT_OQ)),
+			       clip = _mm256_and_ps(_mm256_cmp_ps(_mm256_andnot_ps(sign8, d0), rpm, _CMP_LT_OQ),
+				       _mm256_or_ps(_mm256_cmp_ps(d1, rmm, _CMP_GT_OQ), _mm256_cmp_ps(d1, nrmm, _CMP_LT_OQ)));
+			hit = _mm256_or_ps(hit, _mm256_or_ps(anti, clip));
 		}
+		res |= (uint32_t)_mm256_movemask_ps(hit) << i;
 	}
-	else if (c1->getType() == COLLIDER_TYPE_RECT) {
-		if (c2->getType() == COLLIDER_TYPE_POINT) {
-			std::swap(c1, c2);
-			cf = &ColliderPair::collidePointRect;
+#endif
+#ifdef __SSE2__
+	__m128 m4 = _mm_set1_ps(PH_SCREEN_MARGIN), sign4 = _mm_set1_ps(-0.f);
+	for (; i + 4 <= PH_SCREEN_WIDTH; i += 4) {
+		__m128 nx = _mm_load_ps(s.nx + i), ny = _mm_load_ps(s.ny + i), nz = _mm_load_ps(s.nz + i), r = _mm_load_ps(s.r + i);
+		__m128 d0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(s.x0 + i), nx), _mm_mul_ps(_mm_load_ps(s.y0 + i), ny)), _mm_mul_ps(_mm_load_ps(s.z0 + i), nz)),
+		       d1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(s.x1 + i), nx), _mm_mul_ps(_mm_load_ps(s.y1 + i), ny)), _mm_mul_ps(_mm_load_ps(s.z1 + i), nz));
+		__m128 rpm = _mm_add_ps(r, m4), rmm = _mm_sub_ps(r, m4);
+		__m128 hit = _mm_and_ps(_mm_and_ps(
+			_mm_cmpgt_ps(d0, _mm_xor_ps(m4, sign4)),
+			_mm_cmplt_ps(d1, rpm)),
+			_mm_cmplt_ps(_mm_sub_ps(d1, d0), m4));
+		if (rect) {
+			__m128 nrpm = _mm_xor_ps(rpm, sign4), nrmm = _mm_xor_ps(rmm, sign4);
+			__m128 anti = _mm_and_ps(_mm_cmplt_ps(d0, nrmm), _mm_cmpgt_ps(d1, nrpm)),
+			       clip = _mm_and_ps(_mm_cmplt_ps(_mm_andnot_ps(sign4, d0), rpm),
+				       _mm_or_ps(_mm_cmpgt_ps(d1, rmm), _mm_cmplt_ps(d1, nrmm)));
+			hit = _mm_or_ps(hit, _mm_or_ps(anti, clip));
 		}
-		else if (c2->getType() == COLLIDER_TYPE_SPHERE) {
-			std::swap(c1, c2);
-			cf = &ColliderPair::collideSphereRect;
+		res |= (uint32_t)_mm_movemask_ps(hit) << i;
+	}
+#endif
+	float d0, d1;
+	for (; i < PH_SCREEN_WIDTH; i++) {
+		d0 = s.x0[i] * s.nx[i] + s.y0[i] * s.ny[i] + s.z0[i] * s.nz[i];
+		d1 = s.x1[i] * s.nx[i] + s.y1[i] * s.ny[i] + s.z1[i] * s.nz[i];
+		bool hit = d0 > -PH_SCREEN_MARGIN && d1 < s.r[i] + PH_SCREEN_MARGIN && d1 - d0 < PH_SCREEN_MARGIN;
+		if (rect) {
+			hit = hit || (d0 < -(s.r[i] - PH_SCREEN_MARGIN) && d1 > -(s.r[i] + PH_SCREEN_MARGIN))
+				|| (abs(d0) < s.r[i] + PH_SCREEN_MARGIN && (d1 > s.r[i] - PH_SCREEN_MARGIN || d1 < -(s.r[i] - PH_SCREEN_MARGIN)));
 		}
+		if (hit) res |= 1u << i;
 	}
-	else if (c2->getType() == COLLIDER_TYPE_MESH) {
-		if (c2->getType() == COLLIDER_TYPE_POINT) {
-			std::swap(c1, c2);
-			nearest = static_cast<const Tri*>(static_cast<MeshCollider*>(c2)->getTris());
-			cf = &ColliderPair::collidePointMesh;
+	return res;
+}
+
+template <ColliderPair::CollisionFunc F> void ColliderPair::checkSphereStaticBucket(ColliderPair* const* ps, size_t n, float dt, std::vector<PhysicsEvent>& ev) {
+	constexpr bool rect = F == &ColliderPair::collideSphereRect;
+	static_assert(PH_SCREEN_WIDTH <= 32);
+	SphereStaticScreen s;
+	const Collider* checked[PH_SCREEN_WIDTH];
+	uint32_t always, hits, numchecked, m;
+	ColliderPair* p;
+	for (size_t b = 0; b < n; b += PH_SCREEN_WIDTH) {
+		m = std::min(n - b, (size_t)PH_SCREEN_WIDTH);
+		always = 0;
+		for (uint32_t i = 0; i < PH_SCREEN_WIDTH; i++) {
+			p = i < m ? ps[b + i] : nullptr;
+			// contacts always have something to do, and anything finite-mass could run into the sphere
+			if (!p || (p->f & COLLIDER_PAIR_FLAG_CONTACT) || p->c2->getMass() != std::numeric_limits<float>::infinity()) {
+				if (p) always |= 1u << i;
+				s.x0[i] = s.y0[i] = s.z0[i] = s.x1[i] = s.y1[i] = s.z1[i] = s.nx[i] = s.ny[i] = s.nz[i] = s.r[i] = 0;
+				continue;
+			}
+			const PlaneCollider* pl = static_cast<const PlaneCollider*>(p->c2);
+			glm::vec3 p0 = p->c1->getLastPos() - pl->getLastPos(), p1 = p->c1->getPos() - pl->getPos(), nm = pl->getNorm();
+			s.x0[i] = p0.x;
+			s.y0[i] = p0.y;
+			s.z0[i] = p0.z;
+			s.x1[i] = p1.x;
+			s.y1[i] = p1.y;
+			s.z1[i] = p1.z;
+			s.nx[i] = nm.x;
+			s.ny[i] = nm.y;
+			s.nz[i] = nm.z;
+			s.r[i] = static_cast<const SphereCollider*>(p->c1)->getR();
+		}
+		hits = (screenSphereStatic(s, rect) | always) & (m == 32 ? UINT32_MAX : (1u << m) - 1);
+		numchecked = 0;
+		for (uint32_t i = 0; i < m; i++) {
+			p = ps[b + i];
+			// a sphere checked earlier in this screen may have moved since it was screened
+			if (!(hits & (1u << i)) && std::find(checked, checked + numchecked, p->c1) == checked + numchecked) continue;
+			p->events = &ev;
+			p->prepareCheck();
+			(p->*F)(dt);
+			p->events = nullptr;
+			checked[numchecked++] = p->c1;
 		}
 	}
+}
 
-	if (!cf) {
+bool ColliderPair::isSupported(ColliderType t1, ColliderType t2) {
+	return getDispatch(kernelIndex(t1, t2)).f != nullptr;
+}
+
+void ColliderPair::setCollisionFunc() {
+	const CollisionDispatch& d = getDispatch(kernelIndex(c1->getType(), c2->getType()));
+	if (!d.f) {
 		FatalError("Unsupported ColliderPair Collider Type combination").raise();
 	}
+	if (d.swap) std::swap(c1, c2);
+	kernel = kernelIndex(c1->getType(), c2->getType());
+	if (c2->getType() == COLLIDER_TYPE_MESH) {
+		nearest = static_cast<const Tri*>(static_cast<MeshCollider*>(c2)->getTris());
+	}
 }
 
-void ColliderPair::check(float dt) {
+void ColliderPair::prepareCheck() {
+#ifdef PH_STATS
+	checks++;
+#endif
 	lreldp = reldp;
 	reldp = c1->getVel() - c2->getVel();
 	netf = c1->getForce() + c2->getForce();
-	(this->*cf)(dt);
 }
 
-bool ColliderPair::testPointTri(const PointCollider& p, const Tri& t) {
+void ColliderPair::check(float dt) {
+	prepareCheck();
+	(this->*getDispatch(kernel).f)(dt);
+}
+
+bool ColliderPair::testPointTri(const glm::vec3& p0, const glm::vec3& p1, const Tri& t) {
 	// while certain optimizations /could/ be made for a strictly gravity and input driven "walking"
 	// point for a camera on ground, we aim for this algorithm to be efficient (when combined with
 	// a well-crafted bounding mesh) enough that they are comperable
@@ -436,30 +1333,47 @@ bool ColliderPair::testPointTri(const PointCollider& p, const Tri& t) {
 	// this technique also assumes a CCW front-face; for CW, swap the inequalities
 	glm::vec3 v;
 	for (uint8_t i = 0; i < 3; i++) {
-		v = p.getLastPos() - t.v[i]->p;
+		v = p0 - t.v[i]->p;
 		if (glm::dot(glm::cross(t.e[i], v), t.n) < 0) return false;
 		// std::cout << glm::dot(v, t.n) << std::endl;
 		if (i == 0 && glm::dot(v, t.n) < 0) return false;
-		v = p.getPos() - t.v[i]->p;
-		if (glm::dot(glm::cross(t.e[i], (p.getPos() - t.v[i]->p)), t.n) < 0) return false;
+		v = p1 - t.v[i]->p;
+		if (glm::dot(glm::cross(t.e[i], v), t.n) < 0) return false;
 		// std::cout << glm::dot(v, t.n) << std::endl;
 		if (i == 0 && glm::dot(v, t.n) > 0) return false;
 	}
 	return true;
 }
 
-bool ColliderPair::pointTriPossible(const PointCollider& p, const Tri& t) {
-	// TODO: consider logic and optimization of this function
-	// can we make this constexpr??
-	glm::vec3 ldp = p.getPos() - p.getLastPos();
-	return glm::dot(ldp, p.getPos() - t.v[0]->p) >= 0
-		 || glm::dot(ldp, p.getPos() - t.v[1]->p) >= 0
-		 || glm::dot(ldp, p.getPos() - t.v[2]->p) >= 0;
+void ColliderPair::checkInto(float dt, std::vector<PhysicsEvent>& ev) {
+	events = &ev;
+	check(dt);
+	events = nullptr;
+}
+
+void ColliderPair::pushEvent(PhysicsEventType t, const glm::vec3& p, const glm::vec3& n, const glm::vec3& impulse) {
+	if (events) events->push_back({this, t, p, n, impulse});
+	else callback(t);
 }
 
-void ColliderPair::newtonianCollide(float dt, const glm::vec3& p, const glm::vec3& n) {
+void ColliderPair::callback(PhysicsEventType t) const {
+	const PhysicsCallback* cb = nullptr;
+	switch (t) {
+		case PH_EVENT_TYPE_COLLIDE: cb = &oncollide; break;
+		case PH_EVENT_TYPE_COUPLE: cb = &oncouple; break;
+		case PH_EVENT_TYPE_DECOUPLE: cb = &ondecouple; break;
+		case PH_EVENT_TYPE_SLIDE: cb = &onslide; break;
+		case PH_EVENT_TYPE_ANTICOLLIDE: cb = &onanticollide; break;
+		case PH_EVENT_TYPE_UNCLIP: cb = &onunclip; break;
+		case PH_EVENT_TYPE_ANTIUNCLIP: cb = &onantiunclip; break;
+	}
+	if (cb->f) cb->f(cb->d);
+}
+
+glm::vec3 ColliderPair::newtonianCollide(float dt, const glm::vec3& p, const glm::vec3& n) {
 	glm::vec3 p0top1 = c1->getPos() - c1->getLastPos();
-	float dt0 = dt * glm::length(p - c1->getLastPos()) / glm::length(p0top1);
+	// c1 may not have moved at all if c2 ran into it
+	float dt0 = p0top1 == glm::vec3(0) ? 0 : dt * glm::length(p - c1->getLastPos()) / glm::length(p0top1);
 	glm::vec3 dp0 = p0top1 / dt;
 	float po1 = c1->getMass() != std::numeric_limits<float>::infinity() ?
 			glm::dot((dp0 + c1->getAcc() * dt0) * c1->getMass(), -n) : 0,
@@ -478,20 +1392,27 @@ void ColliderPair::newtonianCollide(float dt, const glm::vec3& p, const glm::vec
 	}
 	else if (po < PH_CONTACT_THRESHOLD) {
 		newtonianCouple(dt, dt0, n); // if we're here, preventdefault must be false
-		if (oncouple.f) oncouple.f(oncouple.d); 
+		pushEvent(PH_EVENT_TYPE_COUPLE, p, n, glm::vec3(0));
 	}
 	else {
-#ifdef PH_VERBOSE_COLLISIONS
-		std::cout << c1 << " and " << c2 << " bounced, ||po|| = " << glm::length(po) << std::endl;
-#endif
+		PH_LOG_COLLISION(c1 << " and " << c2 << " bounced, ||po|| = " << glm::length(po))
 		/* TODO: there are still losses in this system, figure out what they are */
 		c1->updateCollision(dt0, dt - dt0, c1->getMomentum() + (po1 + po) * n);
 		c2->updateCollision(dt0, dt - dt0, c2->getMomentum() + (po2 + po) * -n);
+		return (po1 + po) * n;
 	}
+	return glm::vec3(0);
 }
 
 void ColliderPair::newtonianCouple(float dt, float dt0, const glm::vec3& n) {
 	f |= COLLIDER_PAIR_FLAG_CONTACT;
+	if (hasManifold()) {
+		// the handler's contact solver takes it from here, starting this step
+		manifold = {n, 0, glm::vec3(0), 0};
+		nf = glm::vec3(0);
+		PH_LOG_COLLISION(c1 << " and " << c2 << " coupled, n = [" << n.x << ", " << n.y << ", " << n.z << "]")
+		return;
+	}
 	nf = c1->getForce() + c2->getForce();
 	glm::vec3 xprime = glm::normalize(glm::vec3(n.y, -n.x, 0));
 	// TODO: check xprime == vec3(0), then do a different basis
@@ -499,9 +1420,7 @@ void ColliderPair::newtonianCouple(float dt, float dt0, const glm::vec3& n) {
 
 	nf = glm::dot(nf, n) * n;
 
-#ifdef PH_VERBOSE_COLLISIONS
-	std::cout << c1 << " and " << c2 << " coupled, ||nf|| = [" << nf.x << ", " << nf.y << ", " << nf.z << "]" << std::endl;
-#endif
+	PH_LOG_COLLISION(c1 << " and " << c2 << " coupled, ||nf|| = [" << nf.x << ", " << nf.y << ", " << nf.z << "]")
 
 	c1->updateContact(-nf, dt0, dt - dt0);
 	c2->updateContact(nf, dt0, dt - dt0);
@@ -520,14 +1439,35 @@ void ColliderPair::newtonianDecouple(float dt) {
 	 *
 	 * also seems to have issue with zero-normal-velocity decoupling (e.g. walking off a plane)
 	 */
-#ifdef PH_VERBOSE_COLLISIONS
-	std::cout << c1 << " and " << c2 << " decoupled" << std::endl;
-#endif
+	PH_LOG_COLLISION(c1 << " and " << c2 << " decoupled")
 	c1->applyForce(nf);
 	c2->applyForce(-nf);
+	nf = glm::vec3(0);
+	manifold.jt = glm::vec3(0);
 	f &= ~COLLIDER_PAIR_FLAG_CONTACT;
 }
 
+float ColliderPair::separation() const {
+	float r = static_cast<const SphereCollider*>(c1)->getR();
+	if (c2->getType() == COLLIDER_TYPE_SPHERE) return glm::length(c1->getPos() - c2->getPos()) - r - static_cast<const SphereCollider*>(c2)->getR();
+	if (c2->getType() == COLLIDER_TYPE_HEIGHTFIELD) {
+		// the surface under the sphere changes as it moves, so look it up again
+		glm::vec3 q, n;
+		if (!static_cast<const HeightfieldCollider*>(c2)->closestPoint(c1->getPos(), r + PH_CONTACT_BREAK_DISTANCE, q, n)) return PH_CONTACT_BREAK_DISTANCE;
+		return glm::dot(c1->getPos() - q, manifold.n) - r;
+	}
+	return glm::dot(c1->getPos() - c2->getPos(), manifold.n) - r;
+}
+
+void ColliderPair::maintainContact(float dt, const glm::vec3& n, float depth) {
+	manifold.n = n;
+	manifold.depth = depth;
+	manifold.age++;
+	pushEvent(PH_EVENT_TYPE_SLIDE, c1->getPos(), n, glm::vec3(0));
+	// the gap keeps a contact from flickering while the solver settles it
+	if (depth > PH_CONTACT_BREAK_DISTANCE || glm::dot(reldp, n) > PH_DECOUPLE_VELOCITY_THRESHOLD) COLLIDER_PAIR_DECOUPLE_CALL(dt)
+}
+
 void ColliderPair::newtonianSlide(float dt, const glm::vec3& n) {
 	float extranormforce = glm::dot(c1->getForce() + c2->getForce(), n),
 	      normmom = glm::dot(c1->getMomentum() - c2->getMomentum(), n); // plus or minus???
@@ -632,21 +1572,23 @@ void ColliderPair::collidePointRect(float dt) {
 }
 
 void ColliderPair::collidePointMesh(float dt) {
-	// TODO: make this work if the mesh's position and/or rotation has changed [l]
 	/*
 	 * TODO: stress-testing more complex meshes
 	 */
 	PointCollider* p = static_cast<PointCollider*>(c1);
 	MeshCollider* m = static_cast<MeshCollider*>(c2);
-	auto handlecollision = [this, p, m, dt] (const Tri* t) {
-		glm::vec3 p0top1 = p->getPos() - p->getLastPos();
-		float dt0 = -glm::dot(p->getLastPos() - t->v[0]->p, t->n) / glm::dot(p0top1, t->n) * dt;
+	// the point's path relative to the mesh, in mesh space, so a moving mesh looks like a still one
+	glm::quat invrot = glm::inverse(m->getRot());
+	glm::vec3 l0 = invrot * (p->getLastPos() - m->getLastPos()), l1 = invrot * (p->getPos() - m->getPos());
+	auto handlecollision = [this, p, m, dt, l0, l1] (const Tri* t) {
+		glm::vec3 p0top1 = p->getPos() - p->getLastPos(), tn = m->getRot() * t->n;
+		float dt0 = -glm::dot(l0 - t->v[0]->p, t->n) / glm::dot(l1 - l0, t->n) * dt;
 		glm::vec3 dp0 = p0top1 / dt;
 		float po = 0;
 		if (p->getMass() != std::numeric_limits<float>::infinity())
-			po += glm::dot((dp0 + p->getAcc() * dt0) * p->getMass() * (float)p->getDamp() / 255.f, -t->n);
+			po += glm::dot((dp0 + p->getAcc() * dt0) * p->getMass() * (float)p->getDamp() / 255.f, -tn);
 		if (m->getMass() != std::numeric_limits<float>::infinity())
-			po += glm::dot(((m->getPos() - m->getLastPos()) / dt + m->getAcc() * dt0) * m->getMass() * (float)m->getDamp() / 255.f, t->n);
+			po += glm::dot(((m->getPos() - m->getLastPos()) / dt + m->getAcc() * dt0) * m->getMass() * (float)m->getDamp() / 255.f, tn);
 		if (f & COLLIDER_PAIR_FLAG_CONTACT) {
 			if (po > PH_CONTACT_THRESHOLD) {
 				FatalError("Objects no longer in contact").raise();
@@ -661,111 +1603,122 @@ void ColliderPair::collidePointMesh(float dt) {
 			 */
 			f |= COLLIDER_PAIR_FLAG_CONTACT;
 			nf = p->getForce() + m->getForce();
-			glm::vec3 xprime = glm::normalize(glm::vec3(t->n.y, -t->n.x, 0));
-			glm::vec3 zprime = glm::cross(xprime, t->n);
+			glm::vec3 xprime = glm::normalize(glm::vec3(tn.y, -tn.x, 0));
+			glm::vec3 zprime = glm::cross(xprime, tn);
 			// could probably avoid storing xprime and doing cross for zprime
 			/*
 			nf = glm::vec3(
 				glm::dot(nf, xprime), 
-				glm::dot(nf, t->n), 
+				glm::dot(nf, tn), 
 				glm::dot(nf, zprime)
 			);
 			*/
-			nf = glm::vec3(0, glm::dot(nf, t->n), 0);
+			nf = glm::vec3(0, glm::dot(nf, tn), 0);
 			// it seems like there are a lot of simplifications to make here
 			nf = glm::vec3(
 				glm::dot(nf, glm::vec3(xprime.x, 0, 0)),
-				glm::dot(nf, glm::vec3(0, t->n.y, 0)),
+				glm::dot(nf, glm::vec3(0, tn.y, 0)),
 				glm::dot(nf, glm::vec3(0, 0, zprime.z))
 			);
 			p->updateContact(-nf, dt0, dt - dt0);
 			m->updateContact(nf, dt0, dt - dt0);
+			pushEvent(PH_EVENT_TYPE_COUPLE, p->getLastPos() + p0top1 * dt0 / dt, tn, glm::vec3(0));
 		}
 		else {
 			/* TODO: there are still losses in this system, figure out what they are */
-			// can avoid some multiplication by storing po * t->n and then negating it
-			p->updateCollision(dt0, dt - dt0, po * t->n);
-			m->updateCollision(dt0, dt - dt0, po * -t->n);
+			// can avoid some multiplication by storing po * tn and then negating it
+			p->updateCollision(dt0, dt - dt0, po * tn);
+			m->updateCollision(dt0, dt - dt0, po * -tn);
+			pushEvent(PH_EVENT_TYPE_COLLIDE, p->getLastPos() + p0top1 * dt0 / dt, tn, po * tn);
 		}
 		// nearest = static_cast<const void*>(t);
 	};
-	if (testPointTri(*p, *static_cast<const Tri*>(nearest))) {
+	// the last tri hit is the likeliest one to hit again, e.g. when resting on it
+#ifdef PH_STATS
+	if (nearest) tritests++;
+#endif
+	if (nearest && testPointTri(l0, l1, *static_cast<const Tri*>(nearest))) {
 		handlecollision(static_cast<const Tri*>(nearest));
 		return;
 	}
-	std::set<const Tri*> searched = {static_cast<const Tri*>(nearest)}, 
-		searching = {static_cast<const Tri*>(nearest)}, 
-		nextsearch;
-	bool looking = true;
-
-	while (looking) {
-		nextsearch = std::set<const Tri*>();
-		for (const Tri* t : searching) {
-			for (size_t ai = 0; ai < t->numadj; ai++) {
-				if (!searched.contains(t->adj[ai]) && pointTriPossible(*p, *t->adj[ai])) 
-					nextsearch.insert(t->adj[ai]);
-			}
-		}
-		if (nextsearch.size() == 0) {
-			if (f & COLLIDER_PAIR_FLAG_CONTACT) {
-				f &= ~COLLIDER_PAIR_FLAG_CONTACT;
-				p->applyForce(nf);
-				m->applyForce(-nf);
-			}
-			/* 
-			 * note that this non-collision condition requires checking against
-			 * every triangle every frame there is no collision
-			 */
-			return;
+	float t;
+#ifdef PH_STATS
+	const Tri* hit = m->getData()->intersectSegment(l0, l1, t, true, &tritests);
+#else
+	const Tri* hit = m->getData()->intersectSegment(l0, l1, t);
+#endif
+	if (!hit) {
+		if (f & COLLIDER_PAIR_FLAG_CONTACT) {
+			f &= ~COLLIDER_PAIR_FLAG_CONTACT;
+			p->applyForce(nf);
+			m->applyForce(-nf);
+			pushEvent(PH_EVENT_TYPE_DECOUPLE, p->getPos(), glm::vec3(0), glm::vec3(0));
 		}
-		searching = nextsearch;
-		for (const Tri* t : searching) {
-			if (testPointTri(*p, *t)) {
-				handlecollision(t);
-				nearest = t;
-				return;
-			}
-			else searched.insert(t);
+		return;
+	}
+	handlecollision(hit);
+	nearest = hit;
+}
+
+void ColliderPair::collidePointHeightfield(float dt) {
+	PointCollider* pt = static_cast<PointCollider*>(c1);
+	HeightfieldCollider* hf = static_cast<HeightfieldCollider*>(c2);
+
+	float h0, h1;
+	glm::vec3 n0, n1, lp = pt->getLastPos(), p = pt->getPos();
+	if (!hf->getHeight(p.x, p.z, h1, n1)) {
+		// walked off the edge
+		if (f & COLLIDER_PAIR_FLAG_CONTACT) COLLIDER_PAIR_DECOUPLE_CALL(dt)
+		return;
+	}
+	float d1 = p.y - h1, d0 = hf->getHeight(lp.x, lp.z, h0, n0) ? lp.y - h0 : lp.y - h1;
+	if (!(f & COLLIDER_PAIR_FLAG_CONTACT) && d0 >= 0 && d1 < 0) {
+		// as if the surface were straight between the two
+		glm::vec3 colpos = lp + d0 / (d0 - d1) * (p - lp);
+		COLLIDER_PAIR_COLLIDE_CALL(dt, colpos, n1)
+	}
+	else if (f & COLLIDER_PAIR_FLAG_CONTACT) {
+		// unlike a plane the surface can rise under a resting point, so keep it on top
+		if (d1 < 0 && !preventdefault) pt->updateSlide(glm::vec3(0, d1 / dt, 0), dt);
+		COLLIDER_PAIR_SLIDE_CALL(dt, n1);
+		if (glm::dot(c1->getMomentum(), -glm::normalize(nf))
+			 + glm::dot(c2->getMomentum(), glm::normalize(nf)) > PH_CONTACT_THRESHOLD) {
+			COLLIDER_PAIR_DECOUPLE_CALL(dt)
 		}
 	}
-	/* is it possible to reach this point? */
 }
 
 void ColliderPair::collideSphereSphere(float dt) {
 	SphereCollider* sp1 = static_cast<SphereCollider*>(c1),
 		* sp2 = static_cast<SphereCollider*>(c2);
 
+	float r = sp1->getR() + sp2->getR();
 	glm::vec3 p0 = sp1->getLastPos() - sp2->getLastPos(),
 		p1 = sp1->getPos() - sp2->getPos();
 	if (f & COLLIDER_PAIR_FLAG_CONTACT) {
-		// COLLIDER_PAIR_SLIDE_CALL(dt, sp2->getNorm());
-		// TODO: decoupling criterion
+		float l = glm::length(p1);
+		maintainContact(dt, l == 0 ? manifold.n : p1 / l, l - r);
+		return;
 	}
-	else {
-		// TODO: efficiency gainz
-		// TODO: consider edge cases (<=, >=), these are mostly about what the previous/next
-		// collision check should handle
-		glm::vec3 p0top1 = p1 - p0;
-		if (p0top1 == glm::vec3(0)) return;
-		float a = pow(glm::length(p0top1), 2),
-		      b = 2 * glm::dot(p0top1, p0),
-		      c = glm::length(p0) - pow(sp1->getR() + sp2->getR(), 2),
-		      discriminant = pow(b, 2) - 4 * a * c;
-		/* 
-		 * a > 0; its a length squared
-		 * b >= 0; otherwise it'd be going in the wrong direction. check b < 0 to abort for no collision 
-		 * c >= 0; starting point must not be a collision, might even be > 0
-		 */
-		if (discriminant >= 0 && b >= 0) {
-			discriminant = sqrt(discriminant);
-			float t1 = (-b - discriminant) / 2 / a, t2 = (-b + discriminant) / 2 / a, t;
-			if (t1 > 0 && t1 <= 1) t = t1;
-			else if (t2 > 0 && t2 <= 1) t = t2;
-			else return;
-			glm::vec3 colpos = sp1->getLastPos() + t * (sp1->getPos() - sp1->getLastPos());
-			COLLIDER_PAIR_COLLIDE_CALL(dt, colpos, glm::normalize(sp1->getLastPos() - colpos))
-		}
+	glm::vec3 p0top1 = p1 - p0;
+	float a = glm::dot(p0top1, p0top1),
+	      b = 2 * glm::dot(p0top1, p0),
+	      c = glm::dot(p0, p0) - r * r,
+	      t = 0;
+	/* 
+	 * a > 0; its a length squared
+	 * b < 0 if they're getting closer, otherwise there's nothing to do
+	 * c > 0 if they started apart; if they already overlapped they collide right away
+	 */
+	if (a == 0 || b >= 0 || glm::dot(p0, p0) == 0) return;
+	if (c > 0) {
+		float discriminant = b * b - 4 * a * c;
+		if (discriminant < 0) return;
+		t = (-b - sqrt(discriminant)) / 2 / a;
+		if (t > 1) return;
 	}
+	glm::vec3 colpos = sp1->getLastPos() + t * (sp1->getPos() - sp1->getLastPos());
+	COLLIDER_PAIR_COLLIDE_CALL(dt, colpos, glm::normalize(p0 + t * p0top1))
 }
 
 void ColliderPair::collideSpherePlane(float dt) {
@@ -774,18 +1727,13 @@ void ColliderPair::collideSpherePlane(float dt) {
 
 	glm::vec3 p0 = sp->getLastPos() - pl->getLastPos(),
 		p1 = sp->getPos() - pl->getPos();
-	if (f & COLLIDER_PAIR_FLAG_CONTACT) {
-		COLLIDER_PAIR_SLIDE_CALL(dt, pl->getNorm());
-		if (glm::dot(c1->getVel(), pl->getNorm())
-				 + glm::dot(c2->getVel(), -pl->getNorm()) > PH_DECOUPLE_VELOCITY_THRESHOLD) {
-			COLLIDER_PAIR_DECOUPLE_CALL(dt)
-		}
-		// TODO: decoupling criterion
-	}
-	else if (glm::dot(p0, pl->getNorm()) > sp->getR()
-		 && glm::dot(p1, pl->getNorm()) < sp->getR()) {
-		float t = glm::dot(p0 - sp->getR() * pl->getNorm(), pl->getNorm()) / glm::dot(p0 - p1, pl->getNorm());
-		glm::vec3 colpos = sp->getLastPos() + t * (sp->getLastPos() - sp->getPos());
+	if (f & COLLIDER_PAIR_FLAG_CONTACT) maintainContact(dt, pl->getNorm(), glm::dot(p1, pl->getNorm()) - sp->getR());
+	// approaching with the center still in front, from touching or already overlapping counts too (at t = 0)
+	else if (glm::dot(p0, pl->getNorm()) > 0
+		 && glm::dot(p1, pl->getNorm()) < sp->getR()
+		 && glm::dot(p1 - p0, pl->getNorm()) < 0) {
+		float t = std::max(0.f, glm::dot(p0 - sp->getR() * pl->getNorm(), pl->getNorm()) / glm::dot(p0 - p1, pl->getNorm()));
+		glm::vec3 colpos = sp->getLastPos() + t * (sp->getPos() - sp->getLastPos());
 		COLLIDER_PAIR_COLLIDE_CALL(dt, colpos, pl->getNorm())
 	}
 
@@ -798,29 +1746,23 @@ void ColliderPair::collideSphereRect(float dt) {
 	glm::vec3 p0 = sp->getLastPos() - rc->getLastPos(),
 		p1 = sp->getPos() - rc->getPos();
 	if (f & COLLIDER_PAIR_FLAG_CONTACT) {
-		COLLIDER_PAIR_SLIDE_CALL(dt, rc->getNorm());
-		/*
-		if (glm::dot(c1->getVel(), rc->getNorm())
-				 + glm::dot(c2->getVel(), -rc->getNorm()) > PH_DECOUPLE_VELOCITY_THRESHOLD) {
-				 */
-		if (glm::dot(reldp, rc->getNorm()) > PH_DECOUPLE_VELOCITY_THRESHOLD) {
-			COLLIDER_PAIR_DECOUPLE_CALL(dt)
-			std::cout << "threshold decouple " << dt << std::endl;
-			return;
-		}
+		maintainContact(dt, rc->getNorm(), glm::dot(p1, rc->getNorm()) - sp->getR());
+		if (!(f & COLLIDER_PAIR_FLAG_CONTACT)) return;
 		glm::vec3 testpos = p1 - sp->getR() * rc->getNorm();
 		testpos = inverse(rc->getRot()) * testpos;
 		if (testpos.x < -rc->getLen().x || testpos.x > rc->getLen().x
 			|| testpos.z < -rc->getLen().y || testpos.z > rc->getLen().y) {
 			COLLIDER_PAIR_DECOUPLE_CALL(dt)
-			std::cout << "bounds decouple " << dt << std::endl;
+			PH_LOG_COLLISION("bounds decouple " << dt)
 			return;
 		}
 	}
-	else if (glm::dot(p0, rc->getNorm()) > sp->getR()
-		 && glm::dot(p1, rc->getNorm()) < sp->getR()) {
-		float t = glm::dot(p0 - sp->getR() * rc->getNorm(), rc->getNorm()) / glm::dot(p0 - p1, rc->getNorm());
-		glm::vec3 colpos = sp->getLastPos() + t * (sp->getLastPos() - sp->getPos());
+	// approaching with the center still in front, from touching or already overlapping counts too (at t = 0)
+	else if (glm::dot(p0, rc->getNorm()) > 0
+		 && glm::dot(p1, rc->getNorm()) < sp->getR()
+		 && glm::dot(p1 - p0, rc->getNorm()) < 0) {
+		float t = std::max(0.f, glm::dot(p0 - sp->getR() * rc->getNorm(), rc->getNorm()) / glm::dot(p0 - p1, rc->getNorm()));
+		glm::vec3 colpos = sp->getLastPos() + t * (sp->getPos() - sp->getLastPos());
 		glm::vec3 testpos = colpos;
 		testpos -= rc->getPos();
 		testpos = inverse(rc->getRot()) * testpos;
@@ -836,79 +1778,1687 @@ void ColliderPair::collideSphereRect(float dt) {
 	*/
 	float dist0 = glm::dot(p0, rc->getNorm()),
 	      dist1 = glm::dot(p1, rc->getNorm());
-	if (onanticollide.f && dist0 < -sp->getR() && dist1 > -sp->getR()) onanticollide.f(onanticollide.d);
+	if (dist0 < -sp->getR() && dist1 > -sp->getR()) pushEvent(PH_EVENT_TYPE_ANTICOLLIDE, sp->getPos(), rc->getNorm(), glm::vec3(0));
 	if (abs(dist0) < sp->getR()) {
-		if (onunclip.f && dist1 > sp->getR()) onunclip.f(onunclip.d);
-		else if (onantiunclip.f && dist1 < -sp->getR()) onantiunclip.f(onantiunclip.d);
+		if (dist1 > sp->getR()) pushEvent(PH_EVENT_TYPE_UNCLIP, sp->getPos(), rc->getNorm(), glm::vec3(0));
+		else if (dist1 < -sp->getR()) pushEvent(PH_EVENT_TYPE_ANTIUNCLIP, sp->getPos(), rc->getNorm(), glm::vec3(0));
+	}
+}
+
+void ColliderPair::collideSphereHeightfield(float dt) {
+	SphereCollider* sp = static_cast<SphereCollider*>(c1);
+	HeightfieldCollider* hf = static_cast<HeightfieldCollider*>(c2);
+
+	float r = sp->getR();
+	glm::vec3 q, n;
+	/*
+	 * Testing only where a fast sphere ends up misses any ridge it crossed on the way, so sweep it from
+	 * lp instead. The sweep walks only cells under the path, which the broadphase's swept bounds cover.
+	 * Starting out touching is left to the usual test.
+	 */
+	if (!(f & COLLIDER_PAIR_FLAG_CONTACT) && sp->isFast()) {
+		// relative to the heightfield as it is now
+		glm::vec3 o = sp->getLastPos() - hf->getLastPos() + hf->getPos(), m = sp->getPos() - o;
+		float l = glm::length(m), t;
+		if (l > 0 && hf->sweepSphere(o, m / l, r, l, t, n) && t > 0 && glm::dot(m, n) < 0) {
+			COLLIDER_PAIR_COLLIDE_CALL(dt, sp->getLastPos() + t / l * (sp->getPos() - sp->getLastPos()), n)
+			return;
+		}
+	}
+	// a little past r, so a contact that's only just opened up still gets maintained (and broken) properly
+	if (!hf->closestPoint(sp->getPos(), r + PH_CONTACT_BREAK_DISTANCE, q, n)) {
+		if (f & COLLIDER_PAIR_FLAG_CONTACT) COLLIDER_PAIR_DECOUPLE_CALL(dt)
+		return;
+	}
+	float depth = glm::dot(sp->getPos() - q, n) - r;
+	if (f & COLLIDER_PAIR_FLAG_CONTACT) maintainContact(dt, n, depth);
+	else if (depth < 0 && glm::dot(reldp, n) < 0) {
+		// as if the surface were the plane through q
+		float d0 = glm::dot(sp->getLastPos() - q, n) - r;
+		glm::vec3 colpos = sp->getLastPos() + (d0 > 0 ? d0 / (d0 - depth) : 0) * (sp->getPos() - sp->getLastPos());
+		COLLIDER_PAIR_COLLIDE_CALL(dt, colpos, n)
+	}
+}
+
+/*
+ * PhysicsQuerySnapshot
+ */
+
+/*
+ * getBounds is swept from lp to p, but queries only care about where colliders are now. Bounds that
+ * have blown up to NaN become empty, so they're never hit but don't poison their parents.
+ */
+static AABB queryBounds(const Collider* c) {
+	AABB b = c->getBounds();
+	glm::vec3 p = c->getPos(), lp = c->getLastPos();
+	b.min += p - glm::min(p, lp);
+	b.max -= glm::max(p, lp) - p;
+	if (std::isnan(b.min.x) || std::isnan(b.min.y) || std::isnan(b.min.z)
+		|| std::isnan(b.max.x) || std::isnan(b.max.y) || std::isnan(b.max.z)) {
+		b.min = glm::vec3(std::numeric_limits<float>::infinity());
+		b.max = -b.min;
+	}
+	return b;
+}
+
+// corners of a rect, counterclockwise seen from the front; the two query tris are 012 and 023
+static void rectCorners(const RectCollider* rc, glm::vec3 corners[4], glm::vec3& n) {
+	glm::vec3 x = rc->getRot() * glm::vec3(rc->getLen().x, 0, 0), z = rc->getRot() * glm::vec3(0, 0, rc->getLen().y);
+	corners[0] = rc->getPos() - x - z;
+	corners[1] = rc->getPos() - x + z;
+	corners[2] = rc->getPos() + x + z;
+	corners[3] = rc->getPos() + x - z;
+	n = glm::normalize(glm::cross(z, x));
+}
+
+static bool castCollider(Collider* c, const PhysicsRay& r, float rad, float maxt, PhysicsRayHit& hit) {
+	float t;
+	glm::vec3 n, cp;
+	const Tri* tri = nullptr;
+	switch (c->getType()) {
+		case COLLIDER_TYPE_POINT:
+		case COLLIDER_TYPE_SPHERE: {
+			cp = c->getPos();
+			float cr = rad + (c->getType() == COLLIDER_TYPE_SPHERE ? static_cast<const SphereCollider*>(c)->getR() : 0);
+			if (cr == 0 || !raySphere(r.o, r.d, cp, cr, maxt, t)) return false;
+			n = r.o + r.d * t - cp;
+			n = glm::dot(n, n) > 0 ? glm::normalize(n) : -r.d;
+			break;
+		}
+		case COLLIDER_TYPE_PLANE: {
+			const PlaneCollider* pc = static_cast<const PlaneCollider*>(c);
+			float dist = glm::dot(r.o - pc->getPos(), pc->getNorm()), dn = glm::dot(r.d, pc->getNorm());
+			float side = dist >= 0 ? 1 : -1;
+			if (abs(dist) <= rad) t = 0;
+			else {
+				if (dn * side >= 0) return false;
+				t = (side * rad - dist) / dn;
+				if (t > maxt) return false;
+			}
+			n = pc->getNorm() * side;
+			break;
+		}
+		case COLLIDER_TYPE_RECT: {
+			// as two tris, so the edges are rounded off properly for sphere casts
+			glm::vec3 corners[4], rn, n2;
+			rectCorners(static_cast<const RectCollider*>(c), corners, rn);
+			float t2;
+			bool h = sweepSphereTri(r.o, r.d, rad, corners[0], corners[1], corners[2], rn, maxt, t, n);
+			if (sweepSphereTri(r.o, r.d, rad, corners[0], corners[2], corners[3], rn, h ? t : maxt, t2, n2)) {
+				t = t2;
+				n = n2;
+				h = true;
+			}
+			if (!h) return false;
+			break;
+		}
+		case COLLIDER_TYPE_MESH:
+			tri = static_cast<const MeshCollider*>(c)->sweepSphere(r.o, r.d, rad, maxt, t, n);
+			if (!tri) return false;
+			break;
+		case COLLIDER_TYPE_HEIGHTFIELD:
+			if (!static_cast<const HeightfieldCollider*>(c)->sweepSphere(r.o, r.d, rad, maxt, t, n)) return false;
+			break;
+		default:
+			return false;
+	}
+	hit = {c, tri, r.o + r.d * t, n, t};
+	return true;
+}
+
+static bool overlapsCollider(Collider* col, const glm::vec3& c, float rad) {
+	switch (col->getType()) {
+		case COLLIDER_TYPE_POINT:
+			return glm::distance(col->getPos(), c) <= rad;
+		case COLLIDER_TYPE_SPHERE:
+			return glm::distance(col->getPos(), c) <= rad + static_cast<const SphereCollider*>(col)->getR();
+		case COLLIDER_TYPE_PLANE: {
+			const PlaneCollider* pc = static_cast<const PlaneCollider*>(col);
+			return abs(glm::dot(c - pc->getPos(), pc->getNorm())) <= rad;
+		}
+		case COLLIDER_TYPE_RECT: {
+			glm::vec3 corners[4], rn, d;
+			rectCorners(static_cast<const RectCollider*>(col), corners, rn);
+			d = c - closestOnTri(c, corners[0], corners[1], corners[2]);
+			if (glm::dot(d, d) <= rad * rad) return true;
+			d = c - closestOnTri(c, corners[0], corners[2], corners[3]);
+			return glm::dot(d, d) <= rad * rad;
+		}
+		case COLLIDER_TYPE_MESH:
+			return static_cast<const MeshCollider*>(col)->overlapsSphere(c, rad);
+		case COLLIDER_TYPE_HEIGHTFIELD:
+			return static_cast<const HeightfieldCollider*>(col)->overlapsSphere(c, rad);
+		default:
+			return false;
+	}
+}
+
+bool PhysicsQuerySnapshot::raycast(const PhysicsRay& r, PhysicsRayHit& hit) const {
+	return cast(r, 0, hit);
+}
+
+bool PhysicsQuerySnapshot::sphereCast(const PhysicsRay& r, float rad, PhysicsRayHit& hit) const {
+	return cast(r, rad, hit);
+}
+
+void PhysicsQuerySnapshot::raycast(const PhysicsRay* rs, size_t n, PhysicsRayHit* hits) const {
+	for (size_t i = 0; i < n; i++) cast(rs[i], 0, hits[i]);
+}
+
+bool PhysicsQuerySnapshot::cast(const PhysicsRay& r, float rad, PhysicsRayHit& hit) const {
+	hit = {};
+	float maxt = r.maxt;
+	PhysicsRayHit h;
+	for (Collider* c : unbounded) {
+		if (c == r.ignore || !(c->getLayers() & r.mask) || !castCollider(c, r, rad, maxt, h)) continue;
+		hit = h;
+		maxt = h.t;
+	}
+	if (nodes.empty()) return hit.c;
+
+	typedef struct StackEntry {
+		uint32_t ni;
+		float tin;
+	} StackEntry;
+	StackEntry stack[PH_BVH_MAX_DEPTH + 2];
+	uint8_t sp = 0;
+	glm::vec3 invd = 1.f / r.d;
+	float tin, tin2;
+	if (!segmentHitsAABB(r.o, invd, padded(nodes[0].b, rad), maxt, tin)) return hit.c;
+	stack[sp++] = {0, tin};
+	while (sp > 0) {
+		StackEntry se = stack[--sp];
+		// something closer may have been hit since this was pushed
+		if (se.tin > maxt) continue;
+		const BVHNode& node = nodes[se.ni];
+		if (node.numt == 0) {
+			// near child last, so it's searched first and can cut the far one off
+			uint32_t c1 = se.ni + 1, c2 = node.first;
+			bool h1 = segmentHitsAABB(r.o, invd, padded(nodes[c1].b, rad), maxt, tin),
+			     h2 = segmentHitsAABB(r.o, invd, padded(nodes[c2].b, rad), maxt, tin2);
+			if (h1 && h2) {
+				if (tin < tin2) {
+					stack[sp++] = {c2, tin2};
+					stack[sp++] = {c1, tin};
+				}
+				else {
+					stack[sp++] = {c1, tin};
+					stack[sp++] = {c2, tin2};
+				}
+			}
+			else if (h1) stack[sp++] = {c1, tin};
+			else if (h2) stack[sp++] = {c2, tin2};
+			continue;
+		}
+		for (uint32_t i = node.first; i < node.first + node.numt; i++) {
+			if (leaves[i] == r.ignore || !(leaves[i]->getLayers() & r.mask) || !castCollider(leaves[i], r, rad, maxt, h)) continue;
+			hit = h;
+			maxt = h.t;
+		}
+	}
+	return hit.c;
+}
+
+size_t PhysicsQuerySnapshot::overlapSphere(const glm::vec3& c, float rad, std::vector<Collider*>& res, uint32_t mask) const {
+	size_t n0 = res.size();
+	for (Collider* u : unbounded) {
+		if ((u->getLayers() & mask) && overlapsCollider(u, c, rad)) res.push_back(u);
+	}
+	if (nodes.empty()) return res.size() - n0;
+	uint32_t stack[PH_BVH_MAX_DEPTH + 2];
+	uint8_t sp = 0;
+	stack[sp++] = 0;
+	while (sp > 0) {
+		uint32_t ni = stack[--sp];
+		const BVHNode& node = nodes[ni];
+		if (!sphereHitsAABB(c, rad, node.b)) continue;
+		if (node.numt == 0) {
+			stack[sp++] = node.first;
+			stack[sp++] = ni + 1;
+			continue;
+		}
+		for (uint32_t i = node.first; i < node.first + node.numt; i++) {
+			if ((leaves[i]->getLayers() & mask) && overlapsCollider(leaves[i], c, rad)) res.push_back(leaves[i]);
+		}
+	}
+	return res.size() - n0;
+}
+
+void PhysicsQuerySnapshot::build(const std::vector<Collider*>& cs) {
+	leaves.clear();
+	unbounded.clear();
+	std::vector<BVHBuildPrim> prims;
+	prims.reserve(cs.size());
+	std::vector<Collider*> bounded;
+	bounded.reserve(cs.size());
+	AABB b;
+	for (Collider* c : cs) {
+		b = queryBounds(c);
+		if (std::isinf(b.min.x) || std::isinf(b.min.y) || std::isinf(b.min.z)
+			|| std::isinf(b.max.x) || std::isinf(b.max.y) || std::isinf(b.max.z)) {
+			// empty bounds from queryBounds are infinite too, but those colliders belong in the tree
+			if (b.min.x <= b.max.x) {
+				unbounded.push_back(c);
+				continue;
+			}
+			prims.push_back({b, glm::vec3(0), static_cast<uint32_t>(bounded.size())});
+		}
+		else prims.push_back({b, (b.min + b.max) / 2.f, static_cast<uint32_t>(bounded.size())});
+		bounded.push_back(c);
+	}
+	buildBVHNodes(prims, nodes, PH_QUERY_LEAF_SIZE);
+	leaves.resize(bounded.size());
+	for (size_t i = 0; i < prims.size(); i++) leaves[i] = bounded[prims[i].i];
+	numrefits = 0;
+}
+
+void PhysicsQuerySnapshot::refit() {
+	// children always come after their parent, so going backwards sees them first
+	for (size_t ni = nodes.size(); ni-- > 0;) {
+		BVHNode& node = nodes[ni];
+		if (node.numt == 0) {
+			node.b = nodes[ni + 1].b;
+			grow(node.b, nodes[node.first].b);
+			continue;
+		}
+		node.b = queryBounds(leaves[node.first]);
+		for (uint32_t i = node.first + 1; i < node.first + node.numt; i++) grow(node.b, queryBounds(leaves[i]));
+	}
+	numrefits++;
+}
+
+/*
+ * PhysicsSnapshot
+ */
+
+static void writeVarint(std::vector<uint8_t>& out, uint64_t v) {
+	while (v >= 0x80) {
+		out.push_back(v | 0x80);
+		v >>= 7;
+	}
+	out.push_back(v);
+}
+
+static bool readVarint(const uint8_t*& src, const uint8_t* end, uint64_t& v) {
+	v = 0;
+	for (uint8_t shift = 0; src < end && shift < 64; shift += 7) {
+		v |= (uint64_t)(*src & 0x7f) << shift;
+		if (!(*src++ & 0x80)) return true;
+	}
+	return false;
+}
+
+static uint32_t loadWord(const std::vector<uint8_t>& b, size_t w) {
+	uint32_t res = 0;
+	if (w * 4 < b.size()) memcpy(&res, b.data() + w * 4, 4);
+	return res;
+}
+
+/*
+ * Words are XORed against the base (past its end, against zero), then the result is stored as
+ * alternating runs: a varint count of zero words, a varint count of nonzero words, then those words.
+ * Leads with the total word count.
+ */
+void PhysicsSnapshot::encodeDelta(const PhysicsSnapshot& base, std::vector<uint8_t>& out) const {
+	out.clear();
+	size_t n = buf.size() / 4, w = 0, first;
+	writeVarint(out, n);
+	while (w < n) {
+		first = w;
+		while (w < n && loadWord(buf, w) == loadWord(base.buf, w)) w++;
+		writeVarint(out, w - first);
+		first = w;
+		while (w < n && loadWord(buf, w) != loadWord(base.buf, w)) w++;
+		writeVarint(out, w - first);
+		for (size_t i = first; i < w; i++) {
+			uint32_t x = loadWord(buf, i) ^ loadWord(base.buf, i);
+			out.insert(out.end(), reinterpret_cast<const uint8_t*>(&x), reinterpret_cast<const uint8_t*>(&x) + 4);
+		}
 	}
 }
 
-PhysicsHandler::PhysicsHandler() : dt(0) {
-	ti = (float)SDL_GetTicks() / 1000.f;
+bool PhysicsSnapshot::applyDelta(const PhysicsSnapshot& base, const uint8_t* delta, size_t n) {
+	const uint8_t* end = delta + n;
+	uint64_t numwords, zeros, literals, w = 0;
+	if (!readVarint(delta, end, numwords)) return false;
+	buf.resize(numwords * 4);
+	while (w < numwords) {
+		if (!readVarint(delta, end, zeros) || zeros > numwords - w) return false;
+		for (; zeros > 0; zeros--, w++) {
+			uint32_t x = loadWord(base.buf, w);
+			memcpy(buf.data() + w * 4, &x, 4);
+		}
+		if (!readVarint(delta, end, literals) || literals > numwords - w || literals * 4 > (uint64_t)(end - delta)) return false;
+		for (; literals > 0; literals--, w++, delta += 4) {
+			uint32_t x;
+			memcpy(&x, delta, 4);
+			x ^= loadWord(base.buf, w);
+			memcpy(buf.data() + w * 4, &x, 4);
+		}
+	}
+	return delta == end;
+}
+
+/*
+ * PhysicsHandler
+ */
+
+PhysicsHandler::PhysicsHandler() : PhysicsHandler(PH_BROADPHASE_NONE) {}
+
+PhysicsHandler::PhysicsHandler(PhysicsBroadphaseType b, float cellsize) : 
+		numactivepairs(0),
+		nextpairid(0),
+		simtime(0),
+		broadphase(b), 
+		gridcellsize(cellsize), 
+		gridasleepdirty(true),
+		bpstamp(0), 
+		sleeping(true),
+		numasleep(0),
+		warmstarting(true),
+		contactiterations(0),
+		workers(nullptr),
+		fixeddt(0),
+		maxsubsteps(PH_DEFAULT_MAX_SUBSTEPS),
+		numsubsteps(0),
+		accumulator(0),
+		dt(0),
+		queryversion(UINT64_MAX),
+		stopthread(false),
+		threaded(false),
+		numpublished(0),
+		phasetiming(false)
+#ifdef PH_STATS
+		, numsteps(0)
+#endif
+		{
+	resetPhaseTimes();
+	ti = readClock();
 	lastt = ti;
 }
 
 PhysicsHandler::~PhysicsHandler() {
-	for (Collider* c : colliders) delete c;
+	stopThread();
+	for (auto& [t, p] : colliderpools) delete p;
+	if (workers) delete workers;
 }
 
 void PhysicsHandler::start() {
-	lastt = (float)SDL_GetTicks() / 1000.f;
+	lastt = readClock();
+	accumulator = 0;
 }
 
 void PhysicsHandler::update() {
+	double t = readClock();
+	float elapsed = t - lastt;
+	lastt = t;
+	update(elapsed);
+}
+
+void PhysicsHandler::update(float elapsed) {
+	events.clear();
+	contactiterations = 0;
+	if (fixeddt == 0) {
+		numsubsteps = 1;
+		step(elapsed);
+		return;
+	}
+	accumulator += elapsed;
+	numsubsteps = 0;
+	while (accumulator >= fixeddt && numsubsteps < maxsubsteps) {
+		step(fixeddt);
+		accumulator -= fixeddt;
+		numsubsteps++;
+		if (threaded) {
+			// lastt - accumulator is when this step was due
+			fillFrame(frames.getBack(), lastt - accumulator);
+			frames.getBack().step = ++numpublished;
+			frames.publish();
+		}
+	}
+	// past the substep cap we'd rather lose time than have every following update run behind
+	if (accumulator >= fixeddt) accumulator = std::max(0.f, accumulator - fixeddt * floorf(accumulator / fixeddt));
+}
+
+void PhysicsHandler::setFixedTimestep(float step, uint8_t maxsteps) {
+	fixeddt = step;
+	maxsubsteps = maxsteps;
+	accumulator = 0;
+}
+
+void PhysicsHandler::startThread(float step, uint8_t maxsteps) {
+	stopThread();
+	setFixedTimestep(step, maxsteps);
+	lastrots.resize(oriented.size());
+	for (size_t i = 0; i < oriented.size(); i++) lastrots[i] = static_cast<OrientedCollider*>(oriented[i])->r;
+	// sized up front so publishing never allocates; rotations of colliders without one never change
+	for (uint8_t i = 0; i < 3; i++) {
+		PhysicsFrame& f = frames.getSlot(i);
+		f.transforms.assign(colliders.size(), {glm::vec3(0), glm::vec3(0), glm::quat(1, 0, 0, 0), glm::quat(1, 0, 0, 0)});
+		fillFrame(f, readClock());
+		f.step = numpublished;
+	}
+	stopthread = false;
+	threaded = true;
+	physicsthread = std::thread(&PhysicsHandler::threadLoop, this);
+}
+
+void PhysicsHandler::stopThread() {
+	if (!physicsthread.joinable()) return;
+	stopthread.store(true, std::memory_order_release);
+	physicsthread.join();
+	threaded = false;
+	// anything pushed after the last update still happens
+	applyCommands();
+}
+
+void PhysicsHandler::threadLoop() {
+	start();
+	while (!stopthread.load(std::memory_order_acquire)) {
+		applyCommands();
+		update();
+		// sleeps until the next step is due
+		std::this_thread::sleep_for(std::chrono::duration<double>(fixeddt - accumulator));
+	}
+}
+
+void PhysicsHandler::applyCommands() {
+	PhysicsCommand c;
+	while (commands.pop(c)) {
+		switch (c.type) {
+			case PH_COMMAND_APPLY_FORCE:
+				c.c->applyForce(c.v);
+				break;
+			case PH_COMMAND_APPLY_MOMENTUM:
+				c.c->applyMomentum(c.v);
+				break;
+			case PH_COMMAND_SET_POS:
+				c.c->setPos(c.v);
+				break;
+			case PH_COMMAND_TIMED_FORCE:
+				addTimedForce({c.c, c.v, c.dt});
+				break;
+			case PH_COMMAND_TIMED_MOMENTUM:
+				addTimedMomentum({c.c, c.v, c.dt});
+				break;
+			case PH_COMMAND_CALL:
+				if (c.call.f) c.call.f(c.call.d);
+				break;
+		}
+	}
+}
+
+void PhysicsHandler::fillFrame(PhysicsFrame& f, double t) {
+	f.t = t;
+	f.dt = fixeddt;
+	for (size_t ci = 0; ci < colliders.size(); ci++) {
+		f.transforms[ci].p = store.p[ci];
+		f.transforms[ci].lp = store.lp[ci];
+	}
+	for (size_t i = 0; i < oriented.size(); i++) {
+		// colliders and store slots are added together, so si doubles as the collider index
+		PhysicsTransform& pt = f.transforms[oriented[i]->si];
+		pt.lr = lastrots[i];
+		pt.r = static_cast<OrientedCollider*>(oriented[i])->r;
+		lastrots[i] = pt.r;
+	}
+}
+
+void PhysicsHandler::step(float stepdt) {
 	// if we reworked this slightly we could multithread/parallelize it...
-	dt = (float)SDL_GetTicks() / 1000.f - lastt;
-	lastt += dt;
+	dt = stepdt;
+	store.version++;
+#ifdef PH_STATS
+	phasestart = std::chrono::steady_clock::now();
+#else
+	if (phasetiming) phasestart = std::chrono::steady_clock::now();
+#endif
+	// an entry expires on the first step that starts after its dt has fully elapsed
+	while (!timed.empty() && timed.front().expiry < simtime) {
+		std::pop_heap(timed.begin(), timed.end(), timedEntryLater);
+		const TimedEntry& te = timed.back();
+		if (te.force) te.c->applyForce(-te.v);
+		else te.c->applyMomentum(-te.v);
+		timed.pop_back();
+	}
+	simtime += dt;
+	endPhase(PH_PHASE_TIMED_VALUES);
+	for (uint32_t si : store.woken) {
+		if (store.isAsleep(si)) wakeIsland(store.island[si]);
+	}
+	store.woken.clear();
+	for (uint32_t si : store.moved) store.moving[si] = 1;
+	if (!store.moved.empty() && numasleep > 0) wakeMovedAgainst();
+	integrateAwake();
+	for (Collider* c : oriented) c->updateOrientation(dt);
+	endPhase(PH_PHASE_INTEGRATE);
+	if (broadphase != PH_BROADPHASE_NONE) updateBroadphase();
+	if (numasleep > 0) wakeTouchedIslands();
+	endPhase(PH_PHASE_BROADPHASE);
+	size_t firstevent = events.size();
+	checkPairs();
+	endPhase(PH_PHASE_NARROWPHASE);
+	solveContacts();
+	// before the callbacks, which may move things again for the next step
+	for (uint32_t si : store.moved) store.moving[si] = 0;
+	store.moved.clear();
+	endPhase(PH_PHASE_CONTACTS);
+#ifdef PH_STATS
+	countStats(firstevent);
+#endif
+	dispatchEvents(firstevent);
+	endPhase(PH_PHASE_CALLBACKS);
+	if (sleeping) updateSleep();
+	endPhase(PH_PHASE_SLEEP);
+#ifdef PH_STATS
+	stats.getBack().step = ++numsteps;
+	stats.publish();
+#endif
+}
+
+void PhysicsHandler::endPhase(PhysicsPhase p) {
+#ifndef PH_STATS
+	if (!phasetiming) return;
+#endif
+	std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+	double d = std::chrono::duration<double>(t - phasestart).count();
+	if (phasetiming) phasetimes[p] += d;
+#ifdef PH_STATS
+	stats.getBack().phasetimes[p] = d;
+#endif
+	phasestart = t;
+}
+
+#ifdef PH_STATS
+void PhysicsHandler::countStats(size_t firstevent) {
+	PhysicsStats& st = stats.getBack();
+	st.pairschecked = st.contacts = st.tritests = 0;
+	for (ColliderPair* p : activePairs()) {
+		if (p->f & COLLIDER_PAIR_FLAG_CONTACT) st.contacts++;
+		st.pairschecked += p->checks;
+		st.tritests += p->tritests;
+		p->checks = p->tritests = 0;
+	}
+	st.collisions = st.couples = st.decouples = 0;
+	for (size_t i = firstevent; i < events.size(); i++) {
+		if (events[i].type == PH_EVENT_TYPE_COLLIDE) st.collisions++;
+		else if (events[i].type == PH_EVENT_TYPE_COUPLE) st.couples++;
+		else if (events[i].type == PH_EVENT_TYPE_DECOUPLE) st.decouples++;
+	}
+}
+#endif
+
+void PhysicsHandler::integrateAwake() {
+	// equivalent to calling update on every awake collider, but the linear part is done in batches
+	uint32_t first = 0, last, n = store.size();
+	while (first < n) {
+		while (first < n && store.isAsleep(first)) first++;
+		last = first;
+		while (last < n && !store.isAsleep(last)) last++;
+		store.integrate(dt, first, last);
+		first = last;
+	}
+}
+
+void PhysicsHandler::wakeTouchedIslands() {
+	// a new pair between an island and something moving means they're about to touch
+	for (ColliderPair* p : activePairs()) {
+		if (p->c1->isAsleep() && isMoving(p->c2)) wakeIsland(store.island[p->c1->si]);
+		else if (p->c2->isAsleep() && isMoving(p->c1)) wakeIsland(store.island[p->c2->si]);
+	}
+}
+
+void PhysicsHandler::wakeMovedAgainst() {
+	// anything moving in a parked pair is a moved static collider, sleeping ones don't count
+	for (uint32_t i = 0; i < islands.size(); i++) {
+		for (const ColliderPair* p : islandpairs[i]) {
+			if (!isMoving(p->c1) && !isMoving(p->c2)) continue;
+			wakeIsland(i);
+			break;
+		}
+	}
+}
+
+void PhysicsHandler::wakeIsland(uint32_t i) {
+	for (uint32_t si : islands[i]) {
+		store.island[si] = PH_NO_ISLAND;
+		store.sleeptime[si] = 0;
+	}
+	// in creation order, so the pairs' order after waking doesn't depend on how they were parked
+	std::sort(islandpairs[i].begin(), islandpairs[i].end(), [] (const ColliderPair* a, const ColliderPair* b) {return a->id < b->id;});
+	for (ColliderPair* p : islandpairs[i]) {
+		p->parked = false;
+		if (!p->active) continue;
+		enterActiveRange(p);
+		// the broadphase can drop it again next step if it's no longer overlapping
+		if (broadphase != PH_BROADPHASE_NONE) bpactive.push_back(p);
+	}
+	numasleep -= islands[i].size();
+	islands[i].clear();
+	islandpairs[i].clear();
+	freeislands.push_back(i);
+	gridasleepdirty = true;
+}
+
+uint32_t PhysicsHandler::findIsland(uint32_t si) {
+	while (islandparent[si] != si) {
+		islandparent[si] = islandparent[islandparent[si]];
+		si = islandparent[si];
+	}
+	return si;
+}
+
+void PhysicsHandler::updateSleep() {
+	uint32_t n = store.size();
+	islandparent.resize(n);
+	islandawake.assign(n, 0);
+	for (uint32_t si = 0; si < n; si++) {
+		islandparent[si] = si;
+		if (store.isAsleep(si) || store.m[si] == std::numeric_limits<float>::infinity()) continue;
+		if (glm::length(store.dp[si]) < PH_SLEEP_VELOCITY_THRESHOLD
+			&& glm::length(store.ddp[si]) < PH_SLEEP_ACCELERATION_THRESHOLD) store.sleeptime[si] += dt;
+		else store.sleeptime[si] = 0;
+		if (store.sleeptime[si] < PH_SLEEP_TIME) islandawake[si] = 1;
+	}
+	// static colliders don't join islands, otherwise everything on the ground would be one island
+	for (ColliderPair* p : activePairs()) {
+		if (!isMoving(p->c1) || !isMoving(p->c2) || p->c1->store != &store || p->c2->store != &store) continue;
+		uint32_t r1 = findIsland(p->c1->si), r2 = findIsland(p->c2->si);
+		if (r1 == r2) continue;
+		islandparent[r2] = r1;
+		islandawake[r1] |= islandawake[r2];
+	}
+	// union-find root -> the sleeping island it becomes; islands are numbered in order of their first slot
+	rootislands.assign(n, PH_NO_ISLAND);
+	bool fellasleep = false;
+	for (uint32_t si = 0; si < n; si++) {
+		if (store.isAsleep(si) || store.m[si] == std::numeric_limits<float>::infinity()) continue;
+		uint32_t r = findIsland(si);
+		if (islandawake[r]) continue;
+		if (rootislands[r] == PH_NO_ISLAND) {
+			if (freeislands.empty()) {
+				rootislands[r] = islands.size();
+				islands.emplace_back();
+				islandpairs.emplace_back();
+			}
+			else {
+				rootislands[r] = freeislands.back();
+				freeislands.pop_back();
+			}
+		}
+		islands[rootislands[r]].push_back(si);
+		store.island[si] = rootislands[r];
+		store.dp[si] = glm::vec3(0);
+		store.lp[si] = store.p[si];
+		// colliders and store slots are added together, so si doubles as the collider index
+		if (broadphase != PH_BROADPHASE_NONE) updateBounds(si);
+		numasleep++;
+		fellasleep = true;
+	}
+	if (!fellasleep) return;
+	gridasleepdirty = true;
+	// pairs with nothing awake left in them are parked with their island, so they cost nothing until it wakes
+	for (size_t i = 0; i < numactivepairs;) {
+		ColliderPair* p = pairs[i];
+		if (!isPairAsleep(p) || !(p->c1->isAsleep() || p->c2->isAsleep())) {
+			i++;
+			continue;
+		}
+		p->parked = true;
+		islandpairs[p->c1->isAsleep() ? store.island[p->c1->si] : store.island[p->c2->si]].push_back(p);
+		// swaps the last active pair into i, which still needs looking at
+		leaveActiveRange(p);
+	}
+	std::erase_if(bpactive, [] (const ColliderPair* p) {return p->parked;});
+}
+
+void PhysicsHandler::setSleeping(bool s) {
+	sleeping = s;
+	if (sleeping) return;
+	for (uint32_t i = 0; i < islands.size(); i++) {
+		if (!islands[i].empty()) wakeIsland(i);
+	}
+}
+
+void PhysicsHandler::setNumThreads(uint8_t n) {
+	if (workers) delete workers;
+	workers = n > 1 ? new PhysicsWorkerPool(n) : nullptr;
+	threadevents.resize(workers ? n : 0);
+}
+
+void PhysicsHandler::checkPairs() {
+	if (!workers) {
+		serialpairs.clear();
+		for (ColliderPair* p : activePairs()) {
+			if (!isPairAsleep(p) && !isPairMasked(p)) serialpairs.push_back(p);
+		}
+		sortByKernel(serialpairs);
+		checkRuns(serialpairs.data(), serialpairs.size(), events);
+		return;
+	}
+	colorPairs();
+	for (std::vector<ColliderPair*>& b : pairbatches) {
+		// pairs in a batch don't share any moving colliders, so reordering them can't change the result
+		sortByKernel(b);
+		if (b.size() < PH_MIN_PARALLEL_BATCH) {
+			checkRuns(b.data(), b.size(), events);
+			continue;
+		}
+		workers->run(b.size(), [&b, this] (uint8_t ti, uint32_t begin, uint32_t end) {
+			checkRuns(b.data() + begin, end - begin, threadevents[ti]);
+		});
+		// chunks are contiguous and in thread order, so this keeps events in batch order
+		for (std::vector<PhysicsEvent>& te : threadevents) {
+			events.insert(events.end(), te.begin(), te.end());
+			te.clear();
+		}
+	}
+	for (ColliderPair* p : serialpairs) p->checkInto(dt, events);
+}
+
+void PhysicsHandler::solveContacts() {
+	contacts.clear();
+	for (ColliderPair* p : activePairs()) {
+		if ((p->f & COLLIDER_PAIR_FLAG_CONTACT) && p->hasManifold() && !p->preventdefault && !isPairAsleep(p)
+			&& p->c1->store == &store && p->c2->store == &store) contacts.push_back(p);
+	}
+	if (contacts.empty()) return;
+
 	/*
-	 * TODO: find a way to do this with one loop instead of two??
+	 * Split contacts into islands joined by anything the solver can move. islandparent is free until
+	 * updateSleep rebuilds it. Islands are numbered by their first contact and contacts keep their order
+	 * within each, so the split doesn't depend on the thread count.
 	 */
-	for (size_t i = 0; i < tms.size(); i++) {
-		if (tms[i].dt < 0) {
-			tms[i].c->applyMomentum(-tms[i].v);
-			tms.erase(tms.begin() + i);
+	uint32_t n = store.size();
+	islandparent.resize(n);
+	for (uint32_t si = 0; si < n; si++) islandparent[si] = si;
+	for (ColliderPair* p : contacts) {
+		uint32_t s1 = p->c1->si, s2 = p->c2->si;
+		if (invMass(s1) == 0 || invMass(s2) == 0) continue;
+		uint32_t r1 = findIsland(s1), r2 = findIsland(s2);
+		if (r1 != r2) islandparent[r2] = r1;
+	}
+	rootislands.assign(n, PH_NO_ISLAND);
+	contactislands.assign(1, 0);
+	contactisland.resize(contacts.size());
+	for (size_t k = 0; k < contacts.size(); k++) {
+		uint32_t s1 = contacts[k]->c1->si;
+		uint32_t r = findIsland(invMass(s1) == 0 ? contacts[k]->c2->si : s1);
+		if (rootislands[r] == PH_NO_ISLAND) {
+			rootislands[r] = contactislands.size() - 1;
+			contactislands.push_back(0);
 		}
+		contactisland[k] = rootislands[r];
+		contactislands[contactisland[k] + 1]++;
 	}
-	for (size_t i = 0; i < tms.size(); i++) tms[i].dt -= dt;
-	for (size_t i = 0; i < tfs.size(); i++) {
-		if (tfs[i].dt < 0) {
-			tfs[i].c->applyForce(-tfs[i].v);
-			tfs.erase(tfs.begin() + i);
+	uint32_t numislands = contactislands.size() - 1;
+	for (uint32_t i = 0; i < numislands; i++) contactislands[i + 1] += contactislands[i];
+	contactsorted.resize(contacts.size());
+	for (size_t k = 0; k < contacts.size(); k++) contactsorted[contactislands[contactisland[k]]++] = contacts[k];
+	contacts.swap(contactsorted);
+	// the fill above left each offset at its island's end
+	for (uint32_t i = numislands; i > 0; i--) contactislands[i] = contactislands[i - 1];
+	contactislands[0] = 0;
+
+	islanditerations.resize(numislands * 3);
+	if (workers && numislands > 1 && contacts.size() >= PH_MIN_PARALLEL_BATCH) {
+		workers->run(numislands, [this] (uint8_t /*ti*/, uint32_t begin, uint32_t end) {
+			for (uint32_t i = begin; i < end; i++) {
+				solveContactIsland(contacts.data() + contactislands[i], contactislands[i + 1] - contactislands[i], &islanditerations[i * 3]);
+			}
+		});
+	}
+	else {
+		for (uint32_t i = 0; i < numislands; i++) {
+			solveContactIsland(contacts.data() + contactislands[i], contactislands[i + 1] - contactislands[i], &islanditerations[i * 3]);
 		}
 	}
-	for (size_t i = 0; i < tfs.size(); i++) tfs[i].dt -= dt;
-	for (Collider* c : colliders) c->update(dt);
-	for (ColliderPair* p : activepairs) p->check(dt);
+	// islands run side by side, so the sweeps a pass took is its slowest island's
+	for (uint8_t pass = 0; pass < 3; pass++) {
+		uint32_t maxit = 0;
+		for (uint32_t i = 0; i < numislands; i++) maxit = std::max(maxit, islanditerations[i * 3 + pass]);
+		contactiterations += maxit;
+	}
+}
+
+void PhysicsHandler::solveContactIsland(ColliderPair* const* cs, size_t n, uint32_t* iterations) {
+	uint32_t it;
+
+	// c1 has -nf applied and c2 nf; turn last step's force to the current normal, or drop it when not warm starting
+	for (size_t k = 0; k < n; k++) {
+		ColliderPair* p = cs[k];
+		uint32_t s1 = p->c1->si, s2 = p->c2->si;
+		float l = warmstarting ? std::max(-glm::dot(p->nf, p->manifold.n), 0.f) : 0;
+		glm::vec3 nf = -l * p->manifold.n, d = p->nf - nf;
+		// static colliders can be shared between islands, so they're never written to
+		if (invMass(s1) != 0) store.ddp[s1] += d * invMass(s1);
+		if (invMass(s2) != 0) store.ddp[s2] -= d * invMass(s2);
+		p->nf = nf;
+		if (!warmstarting) p->manifold.jt = glm::vec3(0);
+	}
+	// sweeps alternate direction, so a push at either end of a chain (e.g. a stack) crosses it in one sweep
+	// normal forces, so no contact is accelerating together
+	for (it = 0; it < PH_CONTACT_MAX_ITERATIONS; it++) {
+		float maxchange = 0;
+		for (size_t k = 0; k < n; k++) {
+			ColliderPair* p = cs[it & 1 ? n - 1 - k : k];
+			uint32_t s1 = p->c1->si, s2 = p->c2->si;
+			float w1 = invMass(s1), w2 = invMass(s2);
+			if (w1 + w2 == 0) continue;
+			const glm::vec3& nm = p->manifold.n;
+			float l = -glm::dot(p->nf, nm),
+			      nl = std::max(l - glm::dot(store.ddp[s1] - store.ddp[s2], nm) / (w1 + w2), 0.f),
+			      dl = nl - l;
+			if (w1 != 0) store.ddp[s1] += nm * dl * w1;
+			if (w2 != 0) store.ddp[s2] -= nm * dl * w2;
+			p->nf = -nl * nm;
+			maxchange = std::max(maxchange, std::abs(dl) * (w1 + w2));
+		}
+		if (maxchange < PH_CONTACT_TOLERANCE) break;
+	}
+	iterations[0] = std::min(it + 1, (uint32_t)PH_CONTACT_MAX_ITERATIONS);
+
+	/*
+	 * Velocities: no approaching along the normal, and friction up to what the normal force allows.
+	 * Positions were already integrated with the old velocities, so friction moves them as well, as if
+	 * it had happened before the step; otherwise resting contacts would creep sideways. Overlap from
+	 * approaching is left to the position pass.
+	 */
+	auto impulse = [this, dt = dt] (uint32_t si, const glm::vec3& dv, float w) {
+		if (w == 0) return;
+		store.dp[si] += dv;
+		store.p[si] += dv * dt;
+	};
+	for (size_t k = 0; k < n; k++) {
+		ColliderPair* p = cs[k];
+		uint32_t s1 = p->c1->si, s2 = p->c2->si;
+		impulse(s1, p->manifold.jt * invMass(s1), invMass(s1));
+		impulse(s2, -p->manifold.jt * invMass(s2), invMass(s2));
+	}
+	for (it = 0; it < PH_CONTACT_MAX_ITERATIONS; it++) {
+		float maxchange = 0;
+		for (size_t k = 0; k < n; k++) {
+			ColliderPair* p = cs[it & 1 ? n - 1 - k : k];
+			uint32_t s1 = p->c1->si, s2 = p->c2->si;
+			float w1 = invMass(s1), w2 = invMass(s2);
+			if (w1 + w2 == 0) continue;
+			const glm::vec3& nm = p->manifold.n;
+			glm::vec3 v = store.dp[s1] - store.dp[s2];
+			float vn = glm::dot(v, nm);
+			if (vn < 0) {
+				if (w1 != 0) store.dp[s1] -= nm * vn * w1 / (w1 + w2);
+				if (w2 != 0) store.dp[s2] += nm * vn * w2 / (w1 + w2);
+				v -= vn * nm;
+				maxchange = std::max(maxchange, -vn);
+			}
+			glm::vec3 jt = p->manifold.jt - (v - glm::dot(v, nm) * nm) / (w1 + w2), djt;
+			float maxjt = -glm::dot(p->nf, nm) * (p->c1->getFrictionDyn() + p->c2->getFrictionDyn()) * dt,
+			      ljt = glm::length(jt);
+			if (ljt > maxjt) jt *= maxjt / ljt;
+			djt = jt - p->manifold.jt;
+			impulse(s1, djt * w1, w1);
+			impulse(s2, -djt * w2, w2);
+			p->manifold.jt = jt;
+			maxchange = std::max(maxchange, glm::length(djt) * (w1 + w2));
+		}
+		if (maxchange < PH_CONTACT_TOLERANCE) break;
+	}
+	iterations[1] = std::min(it + 1, (uint32_t)PH_CONTACT_MAX_ITERATIONS);
+
+	// overlap, moving both sides by their share
+	for (it = 0; it < PH_CONTACT_MAX_ITERATIONS; it++) {
+		float maxchange = 0;
+		for (size_t k = 0; k < n; k++) {
+			ColliderPair* p = cs[it & 1 ? n - 1 - k : k];
+			uint32_t s1 = p->c1->si, s2 = p->c2->si;
+			float w1 = invMass(s1), w2 = invMass(s2),
+			      depth = p->separation() + PH_CONTACT_SLOP;
+			if (w1 + w2 == 0 || depth >= 0) continue;
+			if (w1 != 0) store.p[s1] -= p->manifold.n * depth * w1 / (w1 + w2);
+			if (w2 != 0) store.p[s2] += p->manifold.n * depth * w2 / (w1 + w2);
+			maxchange = std::max(maxchange, -depth);
+		}
+		if (maxchange < PH_CONTACT_TOLERANCE) break;
+	}
+	iterations[2] = std::min(it + 1, (uint32_t)PH_CONTACT_MAX_ITERATIONS);
+}
+
+void PhysicsHandler::sortByKernel(std::vector<ColliderPair*>& ps) {
+	// counting sort, so pairs stay in activation order within each kernel
+	constexpr size_t numkernels = COLLIDER_TYPE_COUNT * COLLIDER_TYPE_COUNT;
+	uint32_t offsets[numkernels + 1] = {};
+	for (const ColliderPair* p : ps) offsets[p->kernel + 1]++;
+	for (size_t k = 0; k < numkernels; k++) offsets[k + 1] += offsets[k];
+	kernelsorted.resize(ps.size());
+	for (ColliderPair* p : ps) kernelsorted[offsets[p->kernel]++] = p;
+	ps.swap(kernelsorted);
+}
+
+void PhysicsHandler::checkRuns(ColliderPair* const* ps, size_t n, std::vector<PhysicsEvent>& ev) {
+	// one indirect call per run of pairs sharing a kernel, rather than per pair
+	size_t j;
+	for (size_t i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && ps[j]->kernel == ps[i]->kernel; j++) {}
+		ColliderPair::getDispatch(ps[i]->kernel).bucket(ps + i, j - i, dt, ev);
+	}
+}
+
+void PhysicsHandler::dispatchEvents(size_t first) {
+	for (size_t i = first; i < events.size(); i++) events[i].pair->callback(events[i].type);
+}
+
+void PhysicsHandler::colorPairs() {
+	for (std::vector<ColliderPair*>& b : pairbatches) b.clear();
+	serialpairs.clear();
+	colormasks.assign(store.size(), 0);
+
+	auto iswritten = [this] (const Collider* c) {
+		return c->getMass() != std::numeric_limits<float>::infinity();
+	};
+	uint64_t used;
+	uint8_t color;
+	for (ColliderPair* p : activePairs()) {
+		if (isPairAsleep(p) || isPairMasked(p)) continue;
+		// colliders outside the store can't be tracked, so their pairs just run serially afterwards
+		if (p->c1->store != &store || p->c2->store != &store) {
+			serialpairs.push_back(p);
+			continue;
+		}
+		used = (iswritten(p->c1) ? colormasks[p->c1->si] : 0) | (iswritten(p->c2) ? colormasks[p->c2->si] : 0);
+		if (used == ~(uint64_t)0) {
+			serialpairs.push_back(p);
+			continue;
+		}
+		color = std::countr_one(used);
+		if (color >= pairbatches.size()) pairbatches.resize(color + 1);
+		pairbatches[color].push_back(p);
+		if (iswritten(p->c1)) colormasks[p->c1->si] |= (uint64_t)1 << color;
+		if (iswritten(p->c2)) colormasks[p->c2->si] |= (uint64_t)1 << color;
+	}
 }
 
 ColliderPair* PhysicsHandler::addColliderPair(ColliderPair&& p, bool active) {
-	ColliderPair* res = new ColliderPair(std::move(p));
-	pairs.insert(res);
-	if (active) activateColliderPair(res);
+	ColliderPair* res = findPair(p.c1, p.c2);
+	if (res) {
+		// keep the pair that's there, and any contact it's in, so the response isn't applied twice
+		res->oncollide = std::move(p.oncollide);
+		res->oncouple = std::move(p.oncouple);
+		res->ondecouple = std::move(p.ondecouple);
+		res->onslide = std::move(p.onslide);
+		res->onunclip = std::move(p.onunclip);
+		res->onantiunclip = std::move(p.onantiunclip);
+		res->onanticollide = std::move(p.onanticollide);
+		res->preventdefault = p.preventdefault;
+		res->automatic = false;
+		if (!active) deactivateColliderPair(res);
+	}
+	else {
+		res = pairpool.create(std::move(p));
+		res->id = nextpairid++;
+		res->slot = pairs.size();
+		pairs.push_back(res);
+		insertPairLookup(res);
+	}
+	if (!active || res->active) return res;
+	activateColliderPair(res);
+	// like a pair the broadphase found, so it's deactivated again if the colliders never overlap
+	if (broadphase != PH_BROADPHASE_NONE && res->c1->store == &store && res->c2->store == &store) bpactive.push_back(res);
 	return res;
 }
 
 void PhysicsHandler::removeColliderPair(ColliderPair* p) {
-	activepairs.erase(p);
-	pairs.erase(p);
-	delete p;
+	if (p->parked) std::erase(islandpairs[p->c1->isAsleep() ? store.island[p->c1->si] : store.island[p->c2->si]], p);
+	leaveActiveRange(p);
+	swapPairs(p->slot, pairs.size() - 1);
+	pairs.pop_back();
+	erasePairLookup(p);
+	std::erase(bpactive, p);
+	pairpool.destroy(p);
 }
 
 void PhysicsHandler::activateColliderPair(ColliderPair* p) {
-	activepairs.insert(p);
+	// parked pairs go back in when their island wakes
+	if (!p->parked) enterActiveRange(p);
+	p->active = true;
 }
 
 void PhysicsHandler::deactivateColliderPair(ColliderPair* p) {
-	activepairs.erase(p);
+	leaveActiveRange(p);
+	p->active = false;
+}
+
+void PhysicsHandler::swapPairs(uint32_t a, uint32_t b) {
+	std::swap(pairs[a], pairs[b]);
+	pairs[a]->slot = a;
+	pairs[b]->slot = b;
 }
 
 void PhysicsHandler::addTimedMomentum(TimedValue&& t) {
-	tms.push_back(t);
-	tms.back().c->applyMomentum(tms.back().v);
+	timed.push_back({simtime + t.dt, t.c, t.v, false});
+	std::push_heap(timed.begin(), timed.end(), timedEntryLater);
+	t.c->applyMomentum(t.v);
 }
 
 void PhysicsHandler::addTimedForce(TimedValue&& t) {
-	tfs.push_back(t);
-	tfs.back().c->applyForce(tfs.back().v);
+	timed.push_back({simtime + t.dt, t.c, t.v, true});
+	std::push_heap(timed.begin(), timed.end(), timedEntryLater);
+	t.c->applyForce(t.v);
+}
+
+
+void PhysicsHandler::setOnPairCreate(ColliderType t1, ColliderType t2, PhysicsPairCallback pc) {
+	paircreatecallbacks[t1][t2] = pc;
+	paircreatecallbacks[t2][t1] = pc;
+}
+
+void PhysicsHandler::registerCollider(Collider* c) {
+	c->attach(&store);
+	if (dynamic_cast<OrientedCollider*>(c)) oriented.push_back(c);
+
+	if (broadphase == PH_BROADPHASE_NONE) return;
+	uint32_t ci = colliders.size() - 1;
+	bounds.push_back(c->getBounds());
+	if (broadphase == PH_BROADPHASE_SWEEP_AND_PRUNE) {
+		// inserted unsorted, the next insertion sort will move them into place
+		endpoints.push_back({bounds[ci].min.x, ci, false});
+		endpoints.push_back({bounds[ci].max.x, ci, true});
+	}
+}
+
+// written so that NaN bounds (from a collider whose state has blown up) never overlap anything
+static bool overlaps(const AABB& b1, const AABB& b2) {
+	return b1.min.x <= b2.max.x && b1.max.x >= b2.min.x
+		&& b1.min.y <= b2.max.y && b1.max.y >= b2.min.y
+		&& b1.min.z <= b2.max.z && b1.max.z >= b2.min.z;
+}
+
+void PhysicsHandler::updateBounds(uint32_t ci) {
+	bounds[ci] = colliders[ci]->getBounds();
+	bounds[ci].min -= glm::vec3(PH_BROADPHASE_MARGIN);
+	bounds[ci].max += glm::vec3(PH_BROADPHASE_MARGIN);
+}
+
+void PhysicsHandler::updateBroadphase() {
+	for (size_t ci = 0; ci < colliders.size(); ci++) {
+		// sleeping colliders don't move, their bounds are refreshed as they fall asleep instead
+		if (!store.isAsleep(ci)) updateBounds(ci);
+	}
+
+	bpstamp++;
+	bpactivenext.clear();
+	if (broadphase == PH_BROADPHASE_ALL_PAIRS) allPairs();
+	else if (broadphase == PH_BROADPHASE_SWEEP_AND_PRUNE) sweepAndPrune();
+	else if (broadphase == PH_BROADPHASE_HASH_GRID) hashGrid();
+
+	for (ColliderPair* p : bpactive) {
+		// contact forces are only undone by the pair's decouple, so never drop a pair mid-contact
+		if (p->bpstamp != bpstamp && !(p->f & COLLIDER_PAIR_FLAG_CONTACT)) deactivateColliderPair(p);
+		else if (p->bpstamp != bpstamp) bpactivenext.push_back(p);
+	}
+	std::swap(bpactive, bpactivenext);
+}
+
+void PhysicsHandler::sweepAndPrune() {
+	for (SAPEndpoint& e : endpoints) e.v = e.max ? bounds[e.ci].max.x : bounds[e.ci].min.x;
+	/*
+	 * Colliders move little between updates, so the endpoints are nearly sorted already and insertion
+	 * sort runs in close to linear time. Mins sort before maxes at equal values so touching bounds count.
+	 */
+	for (size_t i = 1; i < endpoints.size(); i++) {
+		SAPEndpoint e = endpoints[i];
+		size_t j = i;
+		while (j > 0 && (endpoints[j - 1].v > e.v || (endpoints[j - 1].v == e.v && endpoints[j - 1].max && !e.max))) {
+			endpoints[j] = endpoints[j - 1];
+			j--;
+		}
+		endpoints[j] = e;
+	}
+
+	sapopen.clear();
+	for (const SAPEndpoint& e : endpoints) {
+		if (e.max) {
+			for (size_t oi = 0; oi < sapopen.size(); oi++) {
+				if (sapopen[oi] == e.ci) {
+					sapopen[oi] = sapopen.back();
+					sapopen.pop_back();
+					break;
+				}
+			}
+			continue;
+		}
+		const AABB& b = bounds[e.ci];
+		for (uint32_t oci : sapopen) {
+			const AABB& ob = bounds[oci];
+			if (overlaps(b, ob)) addCandidate(e.ci, oci);
+		}
+		sapopen.push_back(e.ci);
+	}
+}
+
+void PhysicsHandler::allPairs() {
+	for (uint32_t ci1 = 0; ci1 < colliders.size(); ci1++) {
+		const AABB& b1 = bounds[ci1];
+		for (uint32_t ci2 = ci1 + 1; ci2 < colliders.size(); ci2++) {
+			if (overlaps(b1, bounds[ci2])) addCandidate(ci1, ci2);
+		}
+	}
+}
+
+static uint32_t cellHash(int32_t x, int32_t y, int32_t z) {
+	return (uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)z * 83492791u;
+}
+
+void PhysicsHandler::buildGrid(GridTable& g, bool asleep) {
+	float invcs = 1.f / gridcellsize;
+	g.entries.clear();
+	g.large.clear();
+	for (uint32_t ci = 0; ci < colliders.size(); ci++) {
+		if (store.isAsleep(ci) != asleep) continue;
+		const AABB& b = bounds[ci];
+		// a collider whose state has blown up can't collide with anything, don't let it hit the large list
+		if (std::isnan(b.min.x) || std::isnan(b.min.y) || std::isnan(b.min.z)
+			|| std::isnan(b.max.x) || std::isnan(b.max.y) || std::isnan(b.max.z)) continue;
+		glm::vec3 cmin = glm::floor(b.min * invcs), cmax = glm::floor(b.max * invcs);
+		glm::vec3 span = cmax - cmin + glm::vec3(1);
+		// also catches infinite bounds
+		if (!(span.x * span.y * span.z <= PH_GRID_MAX_CELLS_PER_COLLIDER)) {
+			g.large.push_back(ci);
+			continue;
+		}
+		for (int32_t x = cmin.x; x <= (int32_t)cmax.x; x++) {
+			for (int32_t y = cmin.y; y <= (int32_t)cmax.y; y++) {
+				for (int32_t z = cmin.z; z <= (int32_t)cmax.z; z++) {
+					g.entries.push_back({cellHash(x, y, z), ci});
+				}
+			}
+		}
+	}
+	/*
+	 * Counting sort into a power-of-two table on the low bits of the hash; a bucket can then hold several
+	 * cells, but that's no worse than a hash collision.
+	 */
+	g.mask = 1;
+	while (g.mask < g.entries.size()) g.mask <<= 1;
+	g.mask--;
+	g.buckets.assign(g.mask + 2, 0);
+	for (const GridEntry& e : g.entries) g.buckets[(e.h & g.mask) + 1]++;
+	for (size_t bi = 1; bi < g.buckets.size(); bi++) g.buckets[bi] += g.buckets[bi - 1];
+	g.sorted.resize(g.entries.size());
+	// bounds are copied in so the pair loops walk memory linearly
+	for (const GridEntry& e : g.entries) g.sorted[g.buckets[e.h & g.mask]++] = {bounds[e.ci], e.ci};
+	// the scatter above advanced each bucket start to the next bucket's, shift them back
+	for (size_t bi = g.buckets.size() - 1; bi > 0; bi--) g.buckets[bi] = g.buckets[bi - 1];
+	g.buckets[0] = 0;
 }
 
+/*
+ * Sleeping colliders sit in their own table, which is kept between steps, so a mostly sleeping scene
+ * only rebuilds and searches the grid for what's awake. Sleeping pairs are never reported.
+ */
+void PhysicsHandler::hashGrid() {
+	float invcs = 1.f / gridcellsize;
+	if (gridasleepdirty) {
+		buildGrid(gridasleep, true);
+		gridasleepdirty = false;
+	}
+	buildGrid(grid, false);
+
+	/*
+	 * Each pair sharing several cells would be found once per cell, so it's only reported from the
+	 * bucket of the cell containing the min corner of the two bounds' intersection. Extra colliders in
+	 * a bucket are weeded out by the bounds test.
+	 */
+	for (uint32_t bi = 0; bi <= grid.mask; bi++) {
+		for (uint32_t i = grid.buckets[bi]; i < grid.buckets[bi + 1]; i++) {
+			const GridCell& e1 = grid.sorted[i];
+			for (uint32_t j = i + 1; j < grid.buckets[bi + 1]; j++) {
+				const GridCell& e2 = grid.sorted[j];
+				if (e1.ci == e2.ci || !overlaps(e1.b, e2.b)) continue;
+				glm::vec3 home = glm::floor(glm::max(e1.b.min, e2.b.min) * invcs);
+				if ((cellHash(home.x, home.y, home.z) & grid.mask) != bi) continue;
+				addCandidate(e1.ci, e2.ci);
+			}
+		}
+	}
+	// awake against asleep, looking each awake cell up in the sleeping table
+	if (!gridasleep.sorted.empty()) {
+		for (const GridEntry& e : grid.entries) {
+			uint32_t bi = e.h & gridasleep.mask;
+			const AABB& b1 = bounds[e.ci];
+			for (uint32_t i = gridasleep.buckets[bi]; i < gridasleep.buckets[bi + 1]; i++) {
+				const GridCell& e2 = gridasleep.sorted[i];
+				if (!overlaps(b1, e2.b)) continue;
+				glm::vec3 home = glm::floor(glm::max(b1.min, e2.b.min) * invcs);
+				if ((cellHash(home.x, home.y, home.z) & gridasleep.mask) != bi) continue;
+				addCandidate(e.ci, e2.ci);
+			}
+		}
+	}
+
+	for (size_t li = 0; li < grid.large.size(); li++) {
+		bool lmoving = isMoving(colliders[grid.large[li]]);
+		for (uint32_t ci = 0; ci < colliders.size(); ci++) {
+			if (ci == grid.large[li] || (!lmoving && store.isAsleep(ci))) continue;
+			// large-large pairs would otherwise be found from both sides
+			if (ci < grid.large[li] && std::find(grid.large.begin(), grid.large.end(), ci) != grid.large.end()) continue;
+			if (overlaps(bounds[grid.large[li]], bounds[ci])) addCandidate(grid.large[li], ci);
+		}
+	}
+	// sleeping large colliders only need checking against what's awake
+	for (uint32_t li : gridasleep.large) {
+		for (uint32_t ci = 0; ci < colliders.size(); ci++) {
+			if (ci == li || store.isAsleep(ci)) continue;
+			if (std::find(grid.large.begin(), grid.large.end(), ci) != grid.large.end()) continue;
+			if (overlaps(bounds[li], bounds[ci])) addCandidate(li, ci);
+		}
+	}
+}
+
+void PhysicsHandler::addCandidate(uint32_t ci1, uint32_t ci2) {
+	// nothing for the pair to do, and keeping these out lets sleeping pairs drop out of the broadphase
+	if (!isMoving(colliders[ci1]) && !isMoving(colliders[ci2])) return;
+	if (!colliders[ci1]->collidesWith(colliders[ci2])) return;
+	ColliderPair* p = getOrCreatePair(colliders[ci1], colliders[ci2]);
+	if (!p || p->bpstamp == bpstamp) return;
+	p->bpstamp = bpstamp;
+	if (!p->active) activateColliderPair(p);
+	bpactivenext.push_back(p);
+}
+
+ColliderPair* PhysicsHandler::getOrCreatePair(Collider* a, Collider* b) {
+	if (ColliderPair* p = findPair(a, b)) return p;
+	if (!ColliderPair::isSupported(a->getType(), b->getType())) return nullptr;
+	if (a->getMass() == std::numeric_limits<float>::infinity()
+		&& b->getMass() == std::numeric_limits<float>::infinity()) return nullptr;
+	// setCollisionFunc expects the lower type first
+	if (a->getType() > b->getType()) std::swap(a, b);
+	ColliderPair* res = pairpool.create(a, b);
+	res->id = nextpairid++;
+	res->automatic = true;
+	res->slot = pairs.size();
+	pairs.push_back(res);
+	insertPairLookup(res);
+	const PhysicsPairCallback& pc = paircreatecallbacks[a->getType()][b->getType()];
+	if (pc.f) pc.f(res, pc.d);
+	return res;
+}
+
+const PhysicsQuerySnapshot& PhysicsHandler::getQuerySnapshot() {
+	size_t numqueried = querysnapshot.leaves.size() + querysnapshot.unbounded.size();
+	if (queryversion == store.version && numqueried == colliders.size()) return querysnapshot;
+	if (numqueried != colliders.size() || querysnapshot.numrefits >= PH_QUERY_REBUILD_INTERVAL) querysnapshot.build(colliders);
+	else querysnapshot.refit();
+	queryversion = store.version;
+	return querysnapshot;
+}
+
+void PhysicsHandler::raycast(const PhysicsRay* rs, size_t n, PhysicsRayHit* hits) {
+	const PhysicsQuerySnapshot& qs = getQuerySnapshot();
+	if (!workers || n < PH_MIN_PARALLEL_BATCH) {
+		qs.raycast(rs, n, hits);
+		return;
+	}
+	workers->run(n, [&qs, rs, hits] (uint8_t /*ti*/, uint32_t begin, uint32_t end) {
+		qs.raycast(rs + begin, end - begin, hits + begin);
+	});
+}
+
+template <class T> static void snapshotWrite(uint8_t*& dst, const T* src, size_t n) {
+	if (n == 0) return;
+	memcpy(dst, src, n * sizeof(T));
+	dst += n * sizeof(T);
+}
+
+template <class T> static void snapshotRead(const uint8_t*& src, T* dst, size_t n) {
+	if (n == 0) return;
+	memcpy(dst, src, n * sizeof(T));
+	src += n * sizeof(T);
+}
+
+/*
+ * Layout is the header, then each section back to back. Everything is written field by field or from
+ * padding-free types, so unchanged state is byte-for-byte unchanged and deltas stay small.
+ */
+void PhysicsHandler::saveSnapshot(PhysicsSnapshot& s) const {
+	SnapshotHeader h;
+	h.numcolliders = store.size();
+	h.numoriented = oriented.size();
+	h.numbounds = bounds.size();
+	h.numendpoints = endpoints.size();
+	h.numpairs = pairs.size();
+	h.numbpactive = bpactive.size();
+	h.numtimed = timed.size();
+	h.bpstamp = bpstamp;
+	h.nextpairid = nextpairid;
+	h.simtime = simtime;
+	h.accumulator = accumulator;
+	h.dt = dt;
+	size_t size = sizeof(SnapshotHeader)
+		+ h.numcolliders * (4 * sizeof(glm::vec3) + 2 * sizeof(float) + sizeof(uint32_t))
+		+ h.numoriented * sizeof(SnapshotOrientation)
+		+ h.numbounds * sizeof(AABB)
+		+ h.numendpoints * 2 * sizeof(uint32_t)
+		+ h.numpairs * sizeof(SnapshotPair)
+		+ h.numbpactive * sizeof(uint64_t)
+		+ h.numtimed * (sizeof(double) + sizeof(Collider*) + sizeof(glm::vec3) + sizeof(uint32_t));
+	s.buf.resize((size + 3) & ~(size_t)3);
+	uint8_t* dst = s.buf.data();
+	snapshotWrite(dst, &h, 1);
+	snapshotWrite(dst, store.p.data(), h.numcolliders);
+	snapshotWrite(dst, store.dp.data(), h.numcolliders);
+	snapshotWrite(dst, store.ddp.data(), h.numcolliders);
+	snapshotWrite(dst, store.lp.data(), h.numcolliders);
+	snapshotWrite(dst, store.m.data(), h.numcolliders);
+	snapshotWrite(dst, store.sleeptime.data(), h.numcolliders);
+	snapshotWrite(dst, store.island.data(), h.numcolliders);
+	for (const Collider* c : oriented) {
+		const OrientedCollider* oc = static_cast<const OrientedCollider*>(c);
+		SnapshotOrientation so = {oc->r, oc->dr, oc->ddr, glm::vec3(0)};
+		if (c->getType() == COLLIDER_TYPE_PLANE || c->getType() == COLLIDER_TYPE_RECT) so.n = static_cast<const PlaneCollider*>(c)->n;
+		snapshotWrite(dst, &so, 1);
+	}
+	snapshotWrite(dst, bounds.data(), h.numbounds);
+	for (const SAPEndpoint& e : endpoints) {
+		uint32_t ci = e.ci | (e.max ? 0x80000000 : 0);
+		snapshotWrite(dst, &e.v, 1);
+		snapshotWrite(dst, &ci, 1);
+	}
+	for (const ColliderPair* p : pairs) {
+		SnapshotPair sp = {};
+		sp.id = p->id;
+		sp.nearest = p->nearest;
+		sp.nf = p->nf;
+		sp.reldp = p->reldp;
+		sp.lreldp = p->lreldp;
+		sp.dynf = p->dynf;
+		sp.netf = p->netf;
+		sp.mn = p->manifold.n;
+		sp.mjt = p->manifold.jt;
+		sp.mdepth = p->manifold.depth;
+		sp.mage = p->manifold.age;
+		sp.bpstamp = p->bpstamp;
+		sp.f = p->f;
+		sp.active = p->active;
+		snapshotWrite(dst, &sp, 1);
+	}
+	for (const ColliderPair* p : bpactive) snapshotWrite(dst, &p->id, 1);
+	for (const TimedEntry& te : timed) {
+		uint32_t force = te.force;
+		snapshotWrite(dst, &te.expiry, 1);
+		snapshotWrite(dst, &te.c, 1);
+		snapshotWrite(dst, &te.v, 1);
+		snapshotWrite(dst, &force, 1);
+	}
+	// zero the rounding so identical states give identical buffers
+	std::fill(dst, s.buf.data() + s.buf.size(), 0);
+}
+
+void PhysicsHandler::restoreSnapshot(const PhysicsSnapshot& s) {
+	SnapshotHeader h;
+	if (s.size() < sizeof(SnapshotHeader)) FatalError("Restoring an empty physics snapshot").raise();
+	const uint8_t* src = s.data();
+	snapshotRead(src, &h, 1);
+	if (h.numcolliders != store.size() || h.numoriented != oriented.size()
+		|| h.numbounds != bounds.size() || h.numendpoints != endpoints.size())
+		FatalError("Physics snapshot doesn't match this PhysicsHandler's colliders").raise();
+	snapshotRead(src, store.p.data(), h.numcolliders);
+	snapshotRead(src, store.dp.data(), h.numcolliders);
+	snapshotRead(src, store.ddp.data(), h.numcolliders);
+	snapshotRead(src, store.lp.data(), h.numcolliders);
+	snapshotRead(src, store.m.data(), h.numcolliders);
+	snapshotRead(src, store.sleeptime.data(), h.numcolliders);
+	snapshotRead(src, store.island.data(), h.numcolliders);
+	for (Collider* c : oriented) {
+		OrientedCollider* oc = static_cast<OrientedCollider*>(c);
+		SnapshotOrientation so;
+		snapshotRead(src, &so, 1);
+		oc->r = so.r;
+		oc->dr = so.dr;
+		oc->ddr = so.ddr;
+		if (c->getType() == COLLIDER_TYPE_PLANE || c->getType() == COLLIDER_TYPE_RECT) static_cast<PlaneCollider*>(c)->n = so.n;
+	}
+	snapshotRead(src, bounds.data(), h.numbounds);
+	for (SAPEndpoint& e : endpoints) {
+		uint32_t ci;
+		snapshotRead(src, &e.v, 1);
+		snapshotRead(src, &ci, 1);
+		e.ci = ci & 0x7fffffff;
+		e.max = ci & 0x80000000;
+	}
+
+	/*
+	 * The snapshot lists pairs in the order they were in pairs, which puts them back in the same check
+	 * order, so look them up by id as they come; pairs it doesn't list go after them.
+	 */
+	auto idorder = [] (const ColliderPair* a, const ColliderPair* b) {return a->id < b->id;};
+	std::vector<ColliderPair*> byid(pairs), stale;
+	std::vector<uint8_t> saved(byid.size(), 0);
+	std::sort(byid.begin(), byid.end(), idorder);
+	auto findSaved = [&byid] (uint64_t id) -> ptrdiff_t {
+		auto it = std::lower_bound(byid.begin(), byid.end(), id, [] (const ColliderPair* p, uint64_t id) {return p->id < id;});
+		return it == byid.end() || (*it)->id != id ? -1 : it - byid.begin();
+	};
+	size_t numrestored = 0;
+	auto unsaved = [&stale, this, &numrestored] (ColliderPair* p) {
+		// automatic pairs are never removed by the handler, so one that isn't in the snapshot is newer
+		if (p->automatic) {
+			stale.push_back(p);
+			return;
+		}
+		pairs[numrestored++] = p;
+		p->f = COLLIDER_PAIR_FLAG_NONE;
+		p->nf = glm::vec3(0);
+		p->reldp = glm::vec3(0);
+		p->lreldp = glm::vec3(0);
+		p->dynf = glm::vec3(0);
+		p->netf = glm::vec3(0);
+		p->manifold = ContactManifold();
+		p->bpstamp = 0;
+		p->active = false;
+	};
+	for (uint32_t i = 0; i < h.numpairs; i++) {
+		SnapshotPair sp;
+		snapshotRead(src, &sp, 1);
+		ptrdiff_t bi = findSaved(sp.id);
+		// removed since
+		if (bi < 0) continue;
+		saved[bi] = 1;
+		ColliderPair* p = byid[bi];
+		pairs[numrestored++] = p;
+		p->nearest = sp.nearest;
+		p->nf = sp.nf;
+		p->reldp = sp.reldp;
+		p->lreldp = sp.lreldp;
+		p->dynf = sp.dynf;
+		p->netf = sp.netf;
+		p->manifold = {sp.mn, sp.mdepth, sp.mjt, sp.mage};
+		p->bpstamp = sp.bpstamp;
+		p->f = sp.f;
+		p->active = sp.active;
+	}
+	for (size_t i = 0; i < byid.size(); i++) {
+		if (!saved[i]) unsaved(byid[i]);
+	}
+	pairs.resize(numrestored);
+	nextpairid = h.nextpairid;
+	for (uint32_t i = 0; i < pairs.size(); i++) {
+		pairs[i]->slot = i;
+		pairs[i]->parked = false;
+		nextpairid = std::max(nextpairid, pairs[i]->id + 1);
+	}
+	numactivepairs = 0;
+	bpactive.clear();
+	rebuildIslands();
+
+	std::vector<uint64_t> bpids(h.numbpactive);
+	snapshotRead(src, bpids.data(), h.numbpactive);
+	for (uint64_t id : bpids) {
+		ptrdiff_t bi = findSaved(id);
+		if (bi >= 0) bpactive.push_back(byid[bi]);
+	}
+	// only now, since byid still points at them
+	for (ColliderPair* p : stale) {
+		erasePairLookup(p);
+		pairpool.destroy(p);
+	}
+
+	timed.resize(h.numtimed);
+	for (TimedEntry& te : timed) {
+		uint32_t force;
+		snapshotRead(src, &te.expiry, 1);
+		snapshotRead(src, &te.c, 1);
+		snapshotRead(src, &te.v, 1);
+		snapshotRead(src, &force, 1);
+		te.force = force;
+	}
+
+	simtime = h.simtime;
+	accumulator = h.accumulator;
+	dt = h.dt;
+	bpstamp = h.bpstamp;
+	store.woken.clear();
+	store.moved.clear();
+	store.version++;
+	gridasleepdirty = true;
+	events.clear();
+}
+
+void PhysicsHandler::rebuildIslands() {
+	for (std::vector<uint32_t>& i : islands) i.clear();
+	for (std::vector<ColliderPair*>& i : islandpairs) i.clear();
+	numasleep = 0;
+	for (uint32_t si = 0; si < store.size(); si++) {
+		if (!store.isAsleep(si)) continue;
+		if (store.island[si] >= islands.size()) {
+			islands.resize(store.island[si] + 1);
+			islandpairs.resize(store.island[si] + 1);
+		}
+		islands[store.island[si]].push_back(si);
+		numasleep++;
+	}
+	freeislands.clear();
+	for (uint32_t i = islands.size(); i-- > 0;) {
+		if (islands[i].empty()) freeislands.push_back(i);
+	}
+	// parks the same pairs updateSleep would have, and keeps the rest in order
+	for (ColliderPair* p : pairs) {
+		if (!p->active) continue;
+		if (isPairAsleep(p) && (p->c1->isAsleep() || p->c2->isAsleep())) {
+			p->parked = true;
+			islandpairs[p->c1->isAsleep() ? store.island[p->c1->si] : store.island[p->c2->si]].push_back(p);
+		}
+		else swapPairs(p->slot, numactivepairs++);
+	}
+}
+
+double PhysicsHandler::readClock() const {
+	if (clock.f) return clock.f(clock.d);
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+size_t PhysicsHandler::pairHash(const Collider* a, const Collider* b) const {
+	if (b < a) std::swap(a, b);
+	// addresses' low bits are mostly alignment, so mix them up before masking
+	uint64_t h = (uint64_t)(uintptr_t)a * 0x9e3779b97f4a7c15ull ^ (uint64_t)(uintptr_t)b;
+	h *= 0xff51afd7ed558ccdull;
+	return (h ^ (h >> 32)) & (pairtable.size() - 1);
+}
+
+ColliderPair* PhysicsHandler::findPair(const Collider* a, const Collider* b) const {
+	if (pairtable.empty()) return nullptr;
+	size_t mask = pairtable.size() - 1;
+	for (size_t i = pairHash(a, b); pairtable[i]; i = (i + 1) & mask) {
+		ColliderPair* p = pairtable[i];
+		if ((p->c1 == a && p->c2 == b) || (p->c1 == b && p->c2 == a)) return p;
+	}
+	return nullptr;
+}
+
+void PhysicsHandler::insertPairLookup(ColliderPair* p) {
+	auto place = [this] (ColliderPair* p) {
+		size_t mask = pairtable.size() - 1, i = pairHash(p->c1, p->c2);
+		for (; pairtable[i]; i = (i + 1) & mask) {
+			if ((pairtable[i]->c1 == p->c1 && pairtable[i]->c2 == p->c2)
+				|| (pairtable[i]->c1 == p->c2 && pairtable[i]->c2 == p->c1)) break;
+		}
+		pairtable[i] = p;
+	};
+	// every entry is in pairs, so this keeps the table at most half full
+	if (2 * pairs.size() > pairtable.size()) {
+		std::vector<ColliderPair*> old(std::max(2 * pairtable.size(), (size_t)PH_MIN_PAIR_TABLE_SIZE), nullptr);
+		std::swap(old, pairtable);
+		for (ColliderPair* q : old) {
+			if (q) place(q);
+		}
+	}
+	place(p);
+}
+
+void PhysicsHandler::erasePairLookup(const ColliderPair* p) {
+	if (pairtable.empty()) return;
+	size_t mask = pairtable.size() - 1, i = pairHash(p->c1, p->c2);
+	// not there if a later pair between the same colliders replaced it
+	for (; pairtable[i] != p; i = (i + 1) & mask) {
+		if (!pairtable[i]) return;
+	}
+	// shift the rest of the run back over the gap where that doesn't put an entry before its hash
+	for (size_t j = (i + 1) & mask; pairtable[j]; j = (j + 1) & mask) {
+		size_t h = pairHash(pairtable[j]->c1, pairtable[j]->c2);
+		if (((j - h) & mask) < ((j - i) & mask)) continue;
+		pairtable[i] = pairtable[j];
+		i = j;
+	}
+	pairtable[i] = nullptr;
+}
+
+PhysicsWorkerPool::PhysicsWorkerPool(uint8_t n) : numthreads(n), job(nullptr), jobsize(0), generation(0), remaining(0), quit(false) {
+	for (uint8_t ti = 1; ti < n; ti++) threads.emplace_back(&PhysicsWorkerPool::work, this, ti);
+}
+
+PhysicsWorkerPool::~PhysicsWorkerPool() {
+	{
+		std::lock_guard<std::mutex> lk(mut);
+		quit = true;
+	}
+	startcv.notify_all();
+	for (std::thread& t : threads) t.join();
+}
+
+void PhysicsWorkerPool::run(uint32_t n, const Job& f) {
+	{
+		std::lock_guard<std::mutex> lk(mut);
+		job = &f;
+		jobsize = n;
+		remaining = threads.size();
+		generation++;
+	}
+	startcv.notify_all();
+	uint32_t begin, end;
+	chunk(0, n, begin, end);
+	if (begin < end) f(0, begin, end);
+	std::unique_lock<std::mutex> lk(mut);
+	donecv.wait(lk, [this] {return remaining == 0;});
+}
+
+void PhysicsWorkerPool::work(uint8_t ti) {
+	uint64_t seen = 0;
+	uint32_t begin, end;
+	const Job* f;
+	std::unique_lock<std::mutex> lk(mut);
+	while (true) {
+		startcv.wait(lk, [this, seen] {return quit || generation != seen;});
+		if (quit) return;
+		seen = generation;
+		f = job;
+		chunk(ti, jobsize, begin, end);
+		lk.unlock();
+		if (begin < end) (*f)(ti, begin, end);
+		lk.lock();
+		if (--remaining == 0) donecv.notify_one();
+	}
+}
+
+void PhysicsWorkerPool::chunk(uint8_t ti, uint32_t n, uint32_t& begin, uint32_t& end) const {
+	begin = (uint64_t)n * ti / numthreads;
+	end = (uint64_t)n * (ti + 1) / numthreads;
+}
@@ -1,9 +1,24 @@
 #include <vector>
-#include <set>
+#include <algorithm>
+#include <unordered_map>
 #include <functional>
+#include <chrono>
+#include <bit>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdlib>
+#include <array>
+#include <atomic>
+#include <utility>
+#include <memory>
+#include <new>
+#include <span>
+#include <typeindex>
+
+#include <png.h>
 
 #include <ext.hpp>
-#include <SDL3/SDL.h>
 
 #include "Errors.h"
 
@@ -16,9 +31,57 @@
  */
 #define PH_DECOUPLE_VELOCITY_THRESHOLD 0.5 // m/s
 #define PH_FRICTION_THRESHOLD 0.5
-
-#define PH_VERBOSE_COLLISIONS
+// bounds are padded by this much so resting/sliding pairs don't flicker in and out of the broadphase
+#define PH_BROADPHASE_MARGIN 0.05f
+#define PH_DEFAULT_GRID_CELL_SIZE 2.f
+// colliders spanning more cells than this skip the grid and are tested against everything instead
+#define PH_GRID_MAX_CELLS_PER_COLLIDER 64
+#define PH_DEFAULT_MAX_SUBSTEPS 8
+// pair batches smaller than this aren't worth waking the worker threads for
+#define PH_MIN_PARALLEL_BATCH 64
+// sphere-plane/rect pairs screened at once, see ColliderPair::checkSphereStaticBucket
+#define PH_SCREEN_WIDTH 8
+// m of slack in the screen, far more than any rounding difference from the collision functions themselves
+#define PH_SCREEN_MARGIN 0.001f
+/*
+ * Colliders moving and accelerating slower than these for PH_SLEEP_TIME fall asleep, once everything
+ * they're touching (their island) has too.
+ */
+#define PH_SLEEP_VELOCITY_THRESHOLD 0.05f // m/s
+#define PH_SLEEP_ACCELERATION_THRESHOLD 0.05f // m/s^2
+#define PH_SLEEP_TIME 0.5f // s
+#define PH_NO_ISLAND UINT32_MAX
+#define PH_CACHE_LINE_SIZE 64
+#define PH_BVH_LEAF_SIZE 4
+// tris per TriPacket; one SSE register's worth, so a leaf of PH_BVH_LEAF_SIZE is a single packet
+#define PH_TRI_PACKET_SIZE 4
+#define PH_BVH_NUM_BINS 16
+// deeper nodes are left as (possibly large) leaves, which bounds the traversal stack
+#define PH_BVH_MAX_DEPTH 48
+#define PH_QUERY_LEAF_SIZE 2
+// query snapshots refit their tree to the colliders' new bounds this many times before rebuilding it
+#define PH_QUERY_REBUILD_INTERVAL 30
+#define PH_COMMAND_QUEUE_SIZE 1024 // must be a power of two
+#define PH_POOL_CHUNK_SIZE 64 // objects per PhysicsPool allocation
+#define PH_MIN_PAIR_TABLE_SIZE 64 // must be a power of two
+// contact solver, see PhysicsHandler::solveContacts
+#define PH_CONTACT_MAX_ITERATIONS 32 // per pass
+#define PH_CONTACT_TOLERANCE 0.001f // a pass stops once no sweep changes anything by more than this (m/s^2, m/s, or m)
+#define PH_CONTACT_SLOP 0.005f // m of overlap left alone, so resting contacts don't jitter
+#define PH_CONTACT_BREAK_DISTANCE 0.02f // m apart before a contact decouples
+
+// #define PH_VERBOSE_COLLISIONS
 // #define PH_VERBOSE_COLLIDER_OBJECTS
+// per-step counters and phase times, see PhysicsHandler::acquireStats; nothing is counted without it
+// it changes ColliderPair's and PhysicsHandler's layout, so every file including this needs the same setting
+// #define PH_STATS
+
+// compile-time collision log sink, takes a stream expression that isn't even evaluated when disabled
+#ifdef PH_VERBOSE_COLLISIONS
+#define PH_LOG_COLLISION(x) std::cout << x << std::endl;
+#else
+#define PH_LOG_COLLISION(x)
+#endif
 
 typedef enum ColliderType {
 	COLLIDER_TYPE_UNKNOWN,
@@ -26,72 +89,170 @@ typedef enum ColliderType {
 	COLLIDER_TYPE_SPHERE,
 	COLLIDER_TYPE_PLANE,
 	COLLIDER_TYPE_RECT,
-	COLLIDER_TYPE_MESH
+	COLLIDER_TYPE_MESH,
+	COLLIDER_TYPE_HEIGHTFIELD,
+	COLLIDER_TYPE_COUNT
 } ColliderType;
 
+typedef struct AABB {
+	glm::vec3 min, max;
+} AABB;
+
+typedef struct ColliderState {
+	glm::vec3 p, dp, ddp, lp; // since p, dp, and ddp are all updated together, lp must be stored and cannot be derived
+	float m;
+} ColliderState;
+
+class Collider;
+
+/*
+ * Dense structure-of-arrays storage for the linear state of every collider a PhysicsHandler owns.
+ * Colliders added to the handler become handles into this, so the per-update integration can run
+ * as one flat SIMD pass instead of a virtual call and a cache miss per collider.
+ */
+class ColliderStore {
+public:
+	ColliderStore() = default;
+	~ColliderStore() = default;
+
+	uint32_t add(const ColliderState& s);
+	// lp = p; dp += ddp * dt; p += dp * dt; for every stored collider in [first, last)
+	void integrate(float dt, uint32_t first, uint32_t last);
+
+	uint32_t size() const {return m.size();}
+	bool isAsleep(uint32_t i) const {return island[i] != PH_NO_ISLAND;}
+
+	std::vector<glm::vec3> p, dp, ddp, lp;
+	std::vector<float> m;
+	std::vector<float> sleeptime; // how long each collider has been under the sleep thresholds
+	std::vector<uint32_t> island; // the sleeping island each collider is in, or PH_NO_ISLAND if awake
+	std::vector<uint32_t> woken; // sleeping colliders poked since the last step, their islands wake next step
+	std::vector<uint32_t> moved; // infinite-mass colliders put somewhere by hand since the last step
+	std::vector<uint8_t> moving; // per collider, set for the part of a step a moved one counts as moving
+	uint64_t version = 0; // bumped whenever positions change, so query snapshots know they're stale
+};
+
 class Collider {
 public:
 	Collider() :
-		p(glm::vec3(0)),
-		dp(glm::vec3(0)),
-		ddp(glm::vec3(0)),
-		lp(glm::vec3(0)),
-		m(1),
+		type(COLLIDER_TYPE_UNKNOWN),
+		detached({glm::vec3(0), glm::vec3(0), glm::vec3(0), glm::vec3(0), 1}),
+		store(nullptr),
+		si(0),
 		frictiondynamic(1),
 		dampening(0x55),
-		type(COLLIDER_TYPE_UNKNOWN) {}
-	Collider(const Collider& lvalue) = default;
-	Collider(Collider&& rvalue) :
-		p(std::move(rvalue.p)),
-		dp(std::move(rvalue.dp)),
-		ddp(std::move(rvalue.ddp)),
-		lp(std::move(rvalue.lp)),
-		m(std::move(rvalue.m)),
-		type(std::move(rvalue.type)) {}
-	~Collider() = default;
+		layers(1),
+		mask(UINT32_MAX),
+		fast(false) {}
+	// copies are always detached, even if the original belongs to a PhysicsHandler
+	Collider(const Collider& lvalue) :
+		type(lvalue.type),
+		detached(lvalue.getState()),
+		store(nullptr),
+		si(0),
+		frictiondynamic(lvalue.frictiondynamic),
+		dampening(lvalue.dampening),
+		layers(lvalue.layers),
+		mask(lvalue.mask),
+		fast(lvalue.fast) {}
+	Collider(Collider&& rvalue) : Collider(static_cast<const Collider&>(rvalue)) {}
+	virtual ~Collider() = default;
 
 	friend void swap(Collider& lhs, Collider& rhs);
 
 	virtual Collider& operator=(Collider rhs);
 
 	virtual void update(float dt);
+	// no-op for colliders without orientation; lets PhysicsHandler batch the linear part of update
+	virtual void updateOrientation(float /*dt*/) {}
 	// two-step update for both legs before and after collision
 	// TODO: more in-depth descriptions of below
+	// these three leave infinite-mass colliders untouched, which lets pairs sharing one run in parallel
 	virtual void updateCollision(float dt0, float dt1, glm::vec3 mom);
 	virtual void updateContact(glm::vec3 nf, float dt0, float dt1);
 	virtual void updateSlide(glm::vec3 nm, float dt);
-	void setPos(glm::vec3 pos) {p = pos;}
-	void setMass(float ma) {m = ma;}
+	void setPos(glm::vec3 pos) {
+		moved();
+		posRef() = pos;
+	}
+	void setMass(float ma) {massRef() = ma;}
 	void setFrictionDyn(float f) {frictiondynamic = f;}
 	void setDamp(uint8_t d) {dampening = d;}
+	/*
+	 * A collider is in every layer set in layers and only collides with colliders in a layer set in
+	 * mask; both sides have to agree. By default everything is in layer 0 and collides with everything.
+	 * Can be changed at any time: pairs that no longer collide stop being checked once out of contact.
+	 */
+	void setLayers(uint32_t l) {layers = l;}
+	void setMask(uint32_t m) {mask = m;}
+	/*
+	 * Off by default. Fast spheres are swept along their whole path against heightfields, so they can't
+	 * skip over a ridge in one step (sphere-sphere, -plane and -rect pairs are always swept). Meant for
+	 * the few things, e.g. projectiles, that move more than about their radius per step.
+	 */
+	void setFast(bool f) {fast = f;}
+	// these three wake the collider (and everything resting with it) if it's asleep
 	void applyMomentum(glm::vec3 po);
 	void applyForce(glm::vec3 F);
 
-	glm::vec3 getPos() const {return p;}
-	glm::vec3 getVel() const {return dp;}
-	glm::vec3 getAcc() const {return ddp;}
-	glm::vec3 getLastPos() const {return lp;}
-	float getMass() const {return m;}
+	glm::vec3 getPos() const {return store ? store->p[si] : detached.p;}
+	glm::vec3 getVel() const {return store ? store->dp[si] : detached.dp;}
+	glm::vec3 getAcc() const {return store ? store->ddp[si] : detached.ddp;}
+	glm::vec3 getLastPos() const {return store ? store->lp[si] : detached.lp;}
+	float getMass() const {return store ? store->m[si] : detached.m;}
 	float getFrictionDyn() const {return frictiondynamic;}
 	uint8_t getDamp() const {return dampening;}
+	uint32_t getLayers() const {return layers;}
+	uint32_t getMask() const {return mask;}
+	bool isFast() const {return fast;}
+	bool collidesWith(const Collider* c) const {return (layers & c->mask) && (c->layers & mask);}
 	glm::vec3 getMomentum() const; 
 	glm::vec3 getForce() const;
+	// for rendering between fixed steps, see PhysicsHandler::getAlpha
+	glm::vec3 getInterpolatedPos(float alpha) const {return glm::mix(getLastPos(), getPos(), alpha);}
 	ColliderType getType() const {return type;}
+	bool isAsleep() const {return store && store->isAsleep(si);}
+	ColliderState getState() const {return {getPos(), getVel(), getAcc(), getLastPos(), getMass()};}
+	/*
+	 * Swept bounds over the last update (i.e., containing the collider at both lp and p).
+	 * Colliders with no finite extent (e.g. planes) return infinite bounds.
+	 */
+	virtual AABB getBounds() const;
 
 protected:
 	ColliderType type;
 
+	// wakes it if it's asleep, or if it's static, whatever's asleep against it
+	void moved();
+
 private:
-	glm::vec3 p, dp, ddp, lp; // since p, dp, and ddp are all updated together, lp must be stored and cannot be derived
+	friend class PhysicsHandler;
+
+	// holds the collider's state until it's handed to a PhysicsHandler, which moves it into its store
+	ColliderState detached;
+	ColliderStore* store;
+	uint32_t si;
 	/*
 	 * TODO: frictiondynamic description
 	 */
-	float m, frictiondynamic;
+	float frictiondynamic;
 	/*
 	 * dampening applied to the objects momentum contribution during collision, 
 	 * 0 => all momentum diffused, 1 => all momentum transferred
 	 */
 	uint8_t dampening;
+	uint32_t layers, mask;
+	bool fast;
+
+	glm::vec3& posRef() {return store ? store->p[si] : detached.p;}
+	glm::vec3& velRef() {return store ? store->dp[si] : detached.dp;}
+	glm::vec3& accRef() {return store ? store->ddp[si] : detached.ddp;}
+	glm::vec3& lastPosRef() {return store ? store->lp[si] : detached.lp;}
+	float& massRef() {return store ? store->m[si] : detached.m;}
+
+	void setState(const ColliderState& s);
+	void attach(ColliderStore* s);
+	void wake() {if (isAsleep()) store->woken.push_back(si);}
 };
 
 class PointCollider : public Collider {
@@ -114,6 +275,8 @@ public:
 
 	float getR() const {return r;}
 
+	AABB getBounds() const;
+
 private:
 	float r;
 };
@@ -134,6 +297,7 @@ public:
 	OrientedCollider& operator=(OrientedCollider rhs);
 
 	virtual void update(float dt);
+	virtual void updateOrientation(float dt);
 
 	const glm::quat& getRot() const {return r;}
 	const glm::quat& getAngVel() const {return dr;}
@@ -141,6 +305,8 @@ public:
 	void setRot(glm::quat rot);
 
 private:
+	friend class PhysicsHandler; // for snapshots
+
 	glm::quat r, dr, ddr;
 };
 
@@ -156,14 +322,18 @@ public:
 
 	PlaneCollider& operator=(PlaneCollider rhs);
 
-	void update(float dt);
+	void updateOrientation(float dt);
 
 	// adjusts rotation as appropriate
 	void setNorm(glm::vec3 norm);
 
 	const glm::vec3& getNorm() const {return n;}
 
+	AABB getBounds() const;
+
 private:
+	friend class PhysicsHandler; // for snapshots
+
 	// redundant with rotation and implicit default normal of +y
 	// calculated during update if dr != 0, just saves us redundant calc
 	glm::vec3 n; 
@@ -183,45 +353,197 @@ public:
 
 	const glm::vec2& getLen() const {return len;}
 
+	AABB getBounds() const;
+
 private:
 	glm::vec2 len; // expanded ±len from center at p
 };
 
-struct Tri;
-
 typedef struct Vertex {
 	glm::vec3 p;
-	Tri** t = nullptr;
-	size_t numt = 0;
 } Vertex;
 
+// adjacency lives in MeshColliderData, see getAdjacent
 typedef struct Tri {
 	Vertex* v[3];
-
-	Tri** adj = nullptr;
-	size_t numadj = 0;
 	glm::vec3 e[3], n;
 } Tri;
 
-// TODO: should be OrientedCollider
-class MeshCollider : public Collider {
-public:
-	MeshCollider();
-	MeshCollider(const char* f);
-	~MeshCollider();
+/*
+ * Up to PH_TRI_PACKET_SIZE tris of one BVH leaf, laid out for SIMD segment tests. Each leaf starts a
+ * new packet, so lanes past the leaf's last tri are zeroed, which no segment can hit.
+ */
+typedef struct TriPacket {
+	alignas(16) float v0[3][PH_TRI_PACKET_SIZE];
+	alignas(16) float e0[3][PH_TRI_PACKET_SIZE]; // v1 - v0
+	alignas(16) float e2[3][PH_TRI_PACKET_SIZE]; // v2 - v0, i.e. -Tri::e[2]
+} TriPacket;
 
-	MeshCollider& operator=(const MeshCollider& rhs);
-	MeshCollider& operator=(MeshCollider&& rhs);
+/*
+ * Nodes are stored depth-first, so an interior node's first child is the next node in the array.
+ * Leaves cover numt tris starting at the mesh's tris[first]; interior nodes have numt == 0 and first
+ * is the index of their second child.
+ */
+typedef struct BVHNode {
+	AABB b;
+	uint32_t first, numt;
+} BVHNode;
+
+// what a BVH is built from, i is the index of whatever the bounds belong to
+typedef struct BVHBuildPrim {
+	AABB b;
+	glm::vec3 c; // centroid of b
+	uint32_t i;
+} BVHBuildPrim;
 
-	const Tri* getTris() {return tris;}
+/*
+ * A MeshCollider's geometry, in the mesh's own space. It doesn't change once loaded, so any number of
+ * MeshColliders (e.g. every copy of a level piece) can share one, BVH included.
+ */
+class MeshColliderData {
+public:
+	MeshColliderData();
+	MeshColliderData(const char* f);
+	MeshColliderData(const MeshColliderData& lvalue) = delete; // tris point into vertices
+	~MeshColliderData();
+
+	const Tri* getTris() const {return tris;}
+	size_t getNumTris() const {return numt;}
+	// indices of the tris sharing at least one vertex with tris[ti]
+	const uint32_t* getAdjacent(size_t ti) const {return adj + adjoffsets[ti];}
+	uint32_t getNumAdjacent(size_t ti) const {return adjoffsets[ti + 1] - adjoffsets[ti];}
+	const BVHNode* getBVH() const {return bvh.data();}
+	AABB getBounds() const {return bounds;}
+
+	/*
+	 * Returns the first tri crossed by the segment p0 -> p1, or nullptr if there is none. t is set to
+	 * the hit's fraction of the way along the segment. With cullback, only tris crossed from their
+	 * front (CCW) side count, which is what a point moving into the mesh does.
+	 * With PH_STATS, numtested, if given, has the number of tris tested added to it.
+	 */
+	const Tri* intersectSegment(const glm::vec3& p0, const glm::vec3& p1, float& t, bool cullback = true
+#ifdef PH_STATS
+		, uint32_t* numtested = nullptr
+#endif
+		) const;
+	/*
+	 * Returns the first tri a sphere of radius r moving from o along the unit direction d touches
+	 * within maxt, from either side, or nullptr if there is none. t is the distance travelled and n
+	 * points from the tri towards the sphere. r == 0 makes it a raycast.
+	 */
+	const Tri* sweepSphere(const glm::vec3& o, const glm::vec3& d, float r, float maxt, float& t, glm::vec3& n) const;
+	bool overlapsSphere(const glm::vec3& c, float r) const;
 
 private:
+	// all arrays here are cache line aligned and freed with free()
 	Vertex* vertices;
 	Tri* tris; 
+	TriPacket* packets;
 	size_t numv, numt;
+	// by node index, the first of a leaf's packets; its lane l of packet k is tris[first + k * PH_TRI_PACKET_SIZE + l]
+	std::vector<uint32_t> leafpackets;
+	// CSR adjacency, tri ti's neighbors are adj[adjoffsets[ti]] to adj[adjoffsets[ti + 1] - 1]
+	uint32_t* adjoffsets, * adj;
+	AABB bounds;
+	std::vector<BVHNode> bvh;
 
-	void deleteInnards();
 	void loadOBJ(const char* fp);
+	void buildBVH();
+	void buildPackets();
+};
+
+/*
+ * Tris stay in mesh space and queries are brought into it instead, so moving or turning a mesh costs
+ * nothing beyond its own update. Copies share their data.
+ */
+class MeshCollider : public OrientedCollider {
+public:
+	MeshCollider();
+	MeshCollider(const char* f);
+	MeshCollider(std::shared_ptr<const MeshColliderData> d);
+	MeshCollider(const MeshCollider& lvalue) = default;
+	MeshCollider(MeshCollider&& rvalue) :
+		OrientedCollider(std::move(rvalue)),
+		data(std::move(rvalue.data)) {}
+	~MeshCollider() = default;
+
+	MeshCollider& operator=(MeshCollider rhs);
+
+	const std::shared_ptr<const MeshColliderData>& getData() const {return data;}
+	const Tri* getTris() const {return data->getTris();}
+	size_t getNumTris() const {return data->getNumTris();}
+
+	glm::vec3 toLocal(const glm::vec3& v) const {return glm::inverse(getRot()) * (v - getPos());}
+	glm::vec3 toWorld(const glm::vec3& v) const {return getRot() * v + getPos();}
+
+	// data's bounds turned to world space, swept like any other collider's
+	AABB getBounds() const;
+
+	// same as MeshColliderData's, but in world space; tris returned are still in mesh space
+	const Tri* intersectSegment(const glm::vec3& p0, const glm::vec3& p1, float& t, bool cullback = true) const;
+	const Tri* sweepSphere(const glm::vec3& o, const glm::vec3& d, float r, float maxt, float& t, glm::vec3& n) const;
+	bool overlapsSphere(const glm::vec3& c, float r) const;
+
+private:
+	std::shared_ptr<const MeshColliderData> data;
+};
+
+/*
+ * A regular grid of heights over x and z, starting at the collider's position. Each cell is split into
+ * two tris along its (i, j) -> (i + 1, j + 1) diagonal, so it's the same surface a mesh of the grid
+ * would be, but any x, z finds its cell directly and a sample is only 2 bytes. The surface faces +y;
+ * anything under it is pushed back up rather than through.
+ */
+class HeightfieldCollider : public Collider {
+public:
+	HeightfieldCollider();
+	// w x d samples, row-major with rows along z, each sample * heightscale m above the collider
+	HeightfieldCollider(uint32_t w, uint32_t d, float spacing, float heightscale, std::vector<uint16_t>&& s);
+	// a 16-bit grayscale PNG, columns along x and rows along z
+	HeightfieldCollider(const char* f, float spacing, float heightscale);
+	HeightfieldCollider(const HeightfieldCollider& lvalue) = default;
+	HeightfieldCollider(HeightfieldCollider&& rvalue) :
+		Collider(rvalue),
+		w(rvalue.w),
+		d(rvalue.d),
+		spacing(rvalue.spacing),
+		heightscale(rvalue.heightscale),
+		minsample(rvalue.minsample),
+		maxsample(rvalue.maxsample),
+		samples(std::move(rvalue.samples)) {}
+	~HeightfieldCollider() = default;
+
+	HeightfieldCollider& operator=(HeightfieldCollider rhs);
+
+	uint32_t getWidth() const {return w;}
+	uint32_t getDepth() const {return d;}
+	float getSpacing() const {return spacing;}
+	float getHeightScale() const {return heightscale;}
+	const uint16_t* getSamples() const {return samples.data();}
+
+	// surface height and normal under world x, z; false if that's off the grid
+	bool getHeight(float x, float z, float& h, glm::vec3& n) const;
+	/*
+	 * Closest point q on the surface within r of c, or if c is under the surface, the point above it.
+	 * n is the direction to push c out along, so either way the separation is dot(c - q, n).
+	 */
+	bool closestPoint(const glm::vec3& c, float r, glm::vec3& q, glm::vec3& n) const;
+	// as MeshColliderData's, walking only the cells under the sweep
+	bool sweepSphere(const glm::vec3& o, const glm::vec3& dir, float r, float maxt, float& t, glm::vec3& n) const;
+	bool overlapsSphere(const glm::vec3& c, float r) const;
+
+	AABB getBounds() const;
+
+private:
+	uint32_t w, d;
+	float spacing, heightscale;
+	uint16_t minsample, maxsample;
+	std::vector<uint16_t> samples;
+
+	void loadPNG(const char* fp);
+	void findRange();
+	// corners of cell (i, j) relative to the collider: (i, j), (i + 1, j), (i, j + 1), (i + 1, j + 1)
+	void getCell(uint32_t i, uint32_t j, glm::vec3 v[4]) const;
 };
 
 typedef enum ColliderPairFlagBits {
@@ -238,17 +560,52 @@ typedef struct PhysicsCallback {
 	void* d = nullptr;
 } PhysicsCallback;
 
+class ColliderPair;
+
+typedef enum PhysicsEventType {
+	PH_EVENT_TYPE_COLLIDE,
+	PH_EVENT_TYPE_COUPLE,
+	PH_EVENT_TYPE_DECOUPLE,
+	PH_EVENT_TYPE_SLIDE,
+	PH_EVENT_TYPE_ANTICOLLIDE,
+	PH_EVENT_TYPE_UNCLIP,
+	PH_EVENT_TYPE_ANTIUNCLIP
+} PhysicsEventType;
+
+typedef struct PhysicsEvent {
+	ColliderPair* pair;
+	PhysicsEventType type;
+	/*
+	 * p is the point of collision where there is one, otherwise the first collider's position.
+	 * n is the surface normal, zero for decouples.
+	 * impulse is the momentum a bounce added to the first collider, zero for everything else.
+	 */
+	glm::vec3 p, n, impulse;
+} PhysicsEvent;
+
+/*
+ * Kept for as long as a pair is in contact. Only pairs with a sphere first have one; their normal force
+ * (nf) and friction are found by PhysicsHandler::solveContacts rather than when they couple.
+ */
+typedef struct ContactManifold {
+	glm::vec3 n = glm::vec3(0); // from c2 towards c1
+	float depth = 0; // separation along n as of the last check, negative when overlapping
+	glm::vec3 jt = glm::vec3(0); // friction impulse on c1 last step, reapplied first to warm start the next
+	uint32_t age = 0; // steps since coupling
+} ContactManifold;
+
 #define COLLIDER_PAIR_COLLIDE_CALL(dt, cp, n) { \
-	if (!preventdefault) newtonianCollide(dt, cp, n); \
-	if (oncollide.f) oncollide.f(oncollide.d); \
+	glm::vec3 impulse(0); \
+	if (!preventdefault) impulse = newtonianCollide(dt, cp, n); \
+	pushEvent(PH_EVENT_TYPE_COLLIDE, cp, n, impulse); \
 }
 #define COLLIDER_PAIR_SLIDE_CALL(dt, n) { \
 	if (!preventdefault) newtonianSlide(dt, n); \
-	if (onslide.f) onslide.f(onslide.d); \
+	pushEvent(PH_EVENT_TYPE_SLIDE, c1->getPos(), n, glm::vec3(0)); \
 }
 #define COLLIDER_PAIR_DECOUPLE_CALL(dt) { \
 	if (!preventdefault) newtonianDecouple(dt); \
-	if (ondecouple.f) ondecouple.f(ondecouple.d); \
+	pushEvent(PH_EVENT_TYPE_DECOUPLE, c1->getPos(), glm::vec3(0), glm::vec3(0)); \
 }
 
 class ColliderPair {
@@ -257,18 +614,34 @@ public:
 		c1(nullptr), 
 		c2(nullptr), 
 		f(COLLIDER_PAIR_FLAG_NONE), 
-		cf(nullptr),
+		bpstamp(0),
+		active(false),
+		parked(false),
+		automatic(false),
+		id(0),
+		slot(0),
+		kernel(0),
+		preventdefault(false),
 		nearest(nullptr),
+#ifdef PH_STATS
+		checks(0),
+		tritests(0),
+#endif
 		nf(glm::vec3(0)),
 		reldp(0),
 		lreldp(0),
 		dynf(0),
-		preventdefault(false) {}
+		events(nullptr) {}
 	ColliderPair(Collider* col1, Collider* col2);
 	~ColliderPair() = default;
 
 	ColliderPair& operator=(ColliderPair rhs);
 
+	/*
+	 * When called by a PhysicsHandler, callbacks are deferred until after the step, see
+	 * PhysicsHandler::getEvents. Called directly, callbacks happen inline.
+	 * Sphere pairs rely on their handler for contact forces, so resting contacts need one.
+	 */
 	void check(float dt);
 
 	void setOnCollide(PhysicsCallback pc) {oncollide = pc;}
@@ -280,27 +653,94 @@ public:
 	void setOnAntiUnclip(PhysicsCallback pc) {onantiunclip = pc;}
 	void setPreventDefault(bool p) {preventdefault = p;}
 
+	Collider* getCollider1() const {return c1;}
+	Collider* getCollider2() const {return c2;}
+	ColliderPairFlags getFlags() const {return f;}
+	const ContactManifold& getManifold() const {return manifold;}
+	const glm::vec3& getNormalForce() const {return nf;} // on c2; c1 gets the opposite
+
+	// whether there's a collision function for this combination, in either order
+	static bool isSupported(ColliderType t1, ColliderType t2);
+
 private:
+	friend class PhysicsHandler;
+
+	typedef void (ColliderPair::*CollisionFunc)(float);
+	// checks n pairs that all share one collision function, see checkBucket
+	typedef void (*CollisionBucketFunc)(ColliderPair* const*, size_t, float, std::vector<PhysicsEvent>&);
+
+	typedef struct CollisionDispatch {
+		CollisionFunc f = nullptr;
+		CollisionBucketFunc bucket = nullptr;
+		bool swap = false; // whether c1 and c2 have to be swapped to match f's argument order
+	} CollisionDispatch;
+
 	Collider* c1, * c2;
 	ColliderPairFlags f;
-	void (ColliderPair::*cf)(float);
+	uint32_t bpstamp; // last broadphase pass that found this pair overlapping
+	bool active;
+	bool parked; // set aside with a sleeping island rather than in the handler's active pairs
+	bool automatic; // created by the broadphase rather than addColliderPair
+	uint64_t id; // creation order within its handler, which is how snapshots find it again
+	uint32_t slot; // index into its handler's pairs
+	uint8_t kernel; // index of this pair's types in the dispatch table, after any swap
 	bool preventdefault;
 	PhysicsCallback oncollide, oncouple, ondecouple, onslide, onunclip, onantiunclip, onanticollide;
 	
 	const void* nearest;
+#ifdef PH_STATS
+	uint32_t checks, tritests; // since the handler last collected them
+#endif
 	glm::vec3 nf, reldp, lreldp, dynf, netf; // nf is normal force, netf is net force 
 	// could eliminate contact flag by checking if nf is nonzero?
+	ContactManifold manifold;
+
+	// setCollisionFunc puts spheres first, so this is every sphere-sphere/plane/rect/heightfield pair
+	bool hasManifold() const {return c1->getType() == COLLIDER_TYPE_SPHERE;}
+	// from current positions, along manifold.n for everything but other spheres
+	float separation() const;
+	// refreshes the manifold of a pair in contact and decouples it if it's come apart
+	void maintainContact(float dt, const glm::vec3& n, float depth);
 
 	/*
 	 * Note: this function may swap c1 and c2 to make their order predictable for collision functions
 	 */
 	void setCollisionFunc();
+
+	/*
+	 * The dispatch table is built at compile time from collisionKernel<T1, T2>, which is specialized in the
+	 * .cpp for each supported ordered combination. Reversed combinations get the same function
+	 * with swap set.
+	 */
+	template <ColliderType T1, ColliderType T2> static constexpr CollisionFunc collisionKernel() {return nullptr;}
+	template <ColliderType T1, ColliderType T2> static constexpr CollisionDispatch dispatchEntry();
+	template <size_t... I> static constexpr std::array<CollisionDispatch, sizeof...(I)> makeDispatchTable(std::index_sequence<I...>);
+	static const CollisionDispatch& getDispatch(uint8_t k);
+	static uint8_t kernelIndex(ColliderType t1, ColliderType t2) {return t1 * COLLIDER_TYPE_COUNT + t2;}
+
+	// F is a template argument so the loop calls it directly
+	template <CollisionFunc F> static void checkBucket(ColliderPair* const* ps, size_t n, float dt, std::vector<PhysicsEvent>& ev);
+	/*
+	 * For sphere-plane and sphere-rect runs, checkBucket hands off to this. Most of those pairs are a sphere
+	 * nowhere near a static wall, for which the collision function does nothing at all, so pairs out of
+	 * contact with an infinite-mass c2 are first screened PH_SCREEN_WIDTH at a time with SIMD, and only
+	 * the ones that might do something are checked as usual, still in order.
+	 */
+	template <CollisionFunc F> static void checkSphereStaticBucket(ColliderPair* const* ps, size_t n, float dt, std::vector<PhysicsEvent>& ev);
+	void prepareCheck();
 	
 	// could make these non-static
-	static bool testPointTri(const PointCollider& p, const Tri& t);
-	static bool pointTriPossible(const PointCollider& p, const Tri& t);
+	// p0 -> p1 is the point's path in the tri's (i.e., its mesh's) space
+	static bool testPointTri(const glm::vec3& p0, const glm::vec3& p1, const Tri& t);
+
+	std::vector<PhysicsEvent>* events; // where this check's events go, nullptr to call callbacks inline
+
+	void checkInto(float dt, std::vector<PhysicsEvent>& ev);
+	void pushEvent(PhysicsEventType t, const glm::vec3& p, const glm::vec3& n, const glm::vec3& impulse);
+	void callback(PhysicsEventType t) const;
 
-	void newtonianCollide(float dt, const glm::vec3& p, const glm::vec3& n);
+	// returns the momentum added to c1 by a bounce, zero if they coupled instead
+	glm::vec3 newtonianCollide(float dt, const glm::vec3& p, const glm::vec3& n);
 	void newtonianCouple(float dt, float dt0, const glm::vec3& n);
 	void newtonianDecouple(float dt);
 	void newtonianSlide(float dt, const glm::vec3& n);
@@ -318,12 +758,327 @@ private:
 	void collidePointPlane(float dt);
 	void collidePointRect(float dt);
 	void collidePointMesh(float dt);
+	void collidePointHeightfield(float dt);
 
 	void collideSphereSphere(float dt);
 	void collideSpherePlane(float dt);
 	void collideSphereRect(float dt);
+	void collideSphereHeightfield(float dt);
 };
 
+typedef struct PhysicsRay {
+	glm::vec3 o, d; // d must be normalized
+	float maxt = std::numeric_limits<float>::infinity(); // how far along d to look
+	const Collider* ignore = nullptr; // e.g. whatever is doing the looking
+	uint32_t mask = UINT32_MAX; // only colliders in one of these layers are hit
+} PhysicsRay;
+
+typedef struct PhysicsRayHit {
+	Collider* c = nullptr; // nullptr if nothing was hit
+	const Tri* tri = nullptr; // for MeshColliders, the tri hit (in mesh space)
+	glm::vec3 p, n; // p is where the ray (or cast sphere's center) stopped; n faces back towards it
+	float t = 0; // distance along the ray
+} PhysicsRayHit;
+
+/*
+ * A read-only view of a PhysicsHandler's colliders for spatial queries, over a SAH BVH of their
+ * bounds (colliders with infinite bounds, like planes, are kept on the side and always tested).
+ * All queries are const and don't touch anything shared, so any number of threads can run them at
+ * once, as long as nothing updates the handler or moves its colliders in the meantime.
+ * See PhysicsHandler::getQuerySnapshot.
+ *
+ * Point colliders are only found by sphereCast and overlapSphere, since a ray can't hit a point.
+ */
+class PhysicsQuerySnapshot {
+public:
+	PhysicsQuerySnapshot() : numrefits(0) {}
+	~PhysicsQuerySnapshot() = default;
+
+	// closest hit along the ray, false if none
+	bool raycast(const PhysicsRay& r, PhysicsRayHit& hit) const;
+	// as raycast, but for a sphere of radius rad swept along the ray
+	bool sphereCast(const PhysicsRay& r, float rad, PhysicsRayHit& hit) const;
+	// appends every collider in one of mask's layers touching the sphere to res, returns how many were appended
+	size_t overlapSphere(const glm::vec3& c, float rad, std::vector<Collider*>& res, uint32_t mask = UINT32_MAX) const;
+	void raycast(const PhysicsRay* rs, size_t n, PhysicsRayHit* hits) const;
+
+private:
+	friend class PhysicsHandler;
+
+	std::vector<BVHNode> nodes; // same layout as MeshCollider's, leaves index into leaves
+	std::vector<Collider*> leaves;
+	std::vector<Collider*> unbounded;
+	size_t numrefits;
+
+	void build(const std::vector<Collider*>& cs);
+	// keeps the tree's shape, just recomputes bounds
+	void refit();
+	bool cast(const PhysicsRay& r, float rad, PhysicsRayHit& hit) const;
+};
+
+/*
+ * A PhysicsHandler's whole simulation state, packed into one flat buffer for rollback; see
+ * PhysicsHandler::saveSnapshot. Only meaningful to the handler that saved it (it refers to colliders
+ * and pairs by index, id, and address), and only while no colliders have been added since.
+ *
+ * Snapshots of nearby steps are mostly identical, so for sending them around or keeping a long
+ * history, encodeDelta stores just what changed from some base snapshot. The same base is needed
+ * to apply it again.
+ */
+class PhysicsSnapshot {
+public:
+	PhysicsSnapshot() = default;
+	~PhysicsSnapshot() = default;
+
+	const uint8_t* data() const {return buf.data();}
+	size_t size() const {return buf.size();}
+
+	// replaces out's contents, keeping its storage
+	void encodeDelta(const PhysicsSnapshot& base, std::vector<uint8_t>& out) const;
+	// makes this snapshot the one encodeDelta was called on, returns false if delta is malformed
+	bool applyDelta(const PhysicsSnapshot& base, const uint8_t* delta, size_t n);
+
+private:
+	friend class PhysicsHandler;
+
+	std::vector<uint8_t> buf; // always a whole number of words, see encodeDelta
+};
+
+typedef enum PhysicsCommandType {
+	PH_COMMAND_APPLY_FORCE,
+	PH_COMMAND_APPLY_MOMENTUM,
+	PH_COMMAND_SET_POS,
+	PH_COMMAND_TIMED_FORCE,
+	PH_COMMAND_TIMED_MOMENTUM,
+	PH_COMMAND_CALL // calls call.f(call.d) on the physics thread, for anything the others don't cover
+} PhysicsCommandType;
+
+typedef struct PhysicsCommand {
+	PhysicsCommandType type;
+	Collider* c = nullptr;
+	glm::vec3 v = glm::vec3(0);
+	float dt = 0; // for timed values
+	PhysicsCallback call;
+} PhysicsCommand;
+
+typedef struct PhysicsTransform {
+	glm::vec3 p, lp; // after and before the step
+	glm::quat r, lr; // identity for colliders without orientation
+} PhysicsTransform;
+
+// every collider's transform as of one step, see PhysicsHandler::startThread
+typedef struct PhysicsFrame {
+	std::vector<PhysicsTransform> transforms; // in the order colliders were added
+	double t = 0; // clock time the step was due
+	float dt = 0;
+	uint64_t step = 0; // steps taken on the physics thread so far
+
+	/*
+	 * Frames are drawn a step behind, moving from lp to p over the step after t, so this is how far
+	 * along to draw at clock time now.
+	 */
+	float getAlpha(double now) const {return dt == 0 ? 1 : glm::clamp((float)((now - t) / dt), 0.f, 1.f);}
+	glm::vec3 getInterpolatedPos(size_t ci, float alpha) const {return glm::mix(transforms[ci].lp, transforms[ci].p, alpha);}
+	glm::quat getInterpolatedRot(size_t ci, float alpha) const {return glm::slerp(transforms[ci].lr, transforms[ci].r, alpha);}
+} PhysicsFrame;
+
+/*
+ * Lock-free triple buffer for one writer and one reader. The writer always has a slot of its own to
+ * fill and the reader always has the newest complete one, so neither ever waits on the other.
+ */
+template <class T>
+class PhysicsTripleBuffer {
+public:
+	PhysicsTripleBuffer() : back(0), middle(1), front(2) {}
+	~PhysicsTripleBuffer() = default;
+
+	// for setup only, while neither side is using the buffer
+	T& getSlot(uint8_t i) {return slots[i];}
+
+	// writer side
+	T& getBack() {return slots[back];}
+	void publish() {back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;}
+
+	// reader side; the result stays valid until the next acquire
+	const T& acquire() {
+		if (middle.load(std::memory_order_relaxed) & FRESH) front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+		return slots[front];
+	}
+
+private:
+	static constexpr uint8_t INDEX = 0x03, FRESH = 0x04; // fresh is set in middle while it's unread
+
+	T slots[3];
+	alignas(PH_CACHE_LINE_SIZE) uint8_t back;
+	alignas(PH_CACHE_LINE_SIZE) std::atomic<uint8_t> middle;
+	alignas(PH_CACHE_LINE_SIZE) uint8_t front;
+};
+
+// lock-free bounded ring for one producer thread and one consumer thread
+template <class T, size_t N>
+class PhysicsSPSCQueue {
+public:
+	PhysicsSPSCQueue() : head(0), tail(0) {}
+	~PhysicsSPSCQueue() = default;
+
+	// false if full
+	bool push(const T& t) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) == N) return false;
+		items[h & (N - 1)] = t;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+	// false if empty
+	bool pop(T& t) {
+		size_t tl = tail.load(std::memory_order_relaxed);
+		if (tl == head.load(std::memory_order_acquire)) return false;
+		t = items[tl & (N - 1)];
+		tail.store(tl + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	static_assert((N & (N - 1)) == 0, "PhysicsSPSCQueue size must be a power of two");
+
+	std::array<T, N> items;
+	alignas(PH_CACHE_LINE_SIZE) std::atomic<size_t> head; // next slot to push to
+	alignas(PH_CACHE_LINE_SIZE) std::atomic<size_t> tail; // next slot to pop from
+};
+
+// lets a PhysicsHandler own pools of collider classes it only learns about in addCollider
+class PhysicsPoolBase {
+public:
+	virtual ~PhysicsPoolBase() = default;
+};
+
+/*
+ * Slab allocator for objects that mustn't move. Slots come in chunks of N that stay put until the pool
+ * is destroyed, and freed slots are reused newest first, so steady create/destroy churn never reaches
+ * the global heap. Each slot's generation is bumped on both create and destroy (so it's odd while the
+ * slot is in use), which lets a handle of index and generation tell its object from a later occupant.
+ */
+template <class T, size_t N = PH_POOL_CHUNK_SIZE>
+class PhysicsPool : public PhysicsPoolBase {
+public:
+	PhysicsPool() : numslots(0), numalive(0), freehead(UINT32_MAX) {}
+	PhysicsPool(const PhysicsPool&) = delete;
+	PhysicsPool& operator=(const PhysicsPool&) = delete;
+	~PhysicsPool() {
+		for (uint32_t i = 0; i < numslots; i++) {
+			if (getSlot(i).generation & 1) getObject(getSlot(i))->~T();
+		}
+		for (Slot* c : chunks) delete[] c;
+	}
+
+	template <class... A>
+	T* create(A&&... args) {
+		uint32_t i;
+		if (freehead != UINT32_MAX) {
+			i = freehead;
+			freehead = getSlot(i).nextfree;
+		}
+		else {
+			if (numslots == chunks.size() * N) chunks.push_back(new Slot[N]());
+			i = numslots++;
+		}
+		Slot& s = getSlot(i);
+		T* res = new (s.obj) T(std::forward<A>(args)...);
+		s.index = i;
+		s.generation++;
+		numalive++;
+		return res;
+	}
+	void destroy(T* t) {
+		Slot& s = getSlot(t);
+		t->~T();
+		s.generation++;
+		s.nextfree = freehead;
+		freehead = s.index;
+		numalive--;
+	}
+
+	uint32_t getIndex(const T* t) const {return getSlot(t).index;}
+	uint32_t getGeneration(const T* t) const {return getSlot(t).generation;}
+	// nullptr if the object at i has been destroyed since generation g
+	T* get(uint32_t i, uint32_t g) const {
+		if (i >= numslots || getSlot(i).generation != g) return nullptr;
+		return getObject(getSlot(i));
+	}
+	size_t size() const {return numalive;}
+
+private:
+	typedef struct Slot {
+		alignas(T) unsigned char obj[sizeof(T)]; // first, so an object's address is its slot's
+		uint32_t index, generation, nextfree;
+	} Slot;
+
+	std::vector<Slot*> chunks;
+	uint32_t numslots; // ever handed out, including freed ones
+	size_t numalive;
+	uint32_t freehead; // most recently freed slot, UINT32_MAX if none
+
+	Slot& getSlot(uint32_t i) const {return chunks[i / N][i % N];}
+	static Slot& getSlot(const T* t) {return *reinterpret_cast<Slot*>(const_cast<T*>(t));}
+	static T* getObject(Slot& s) {return std::launder(reinterpret_cast<T*>(s.obj));}
+};
+
+// refers to a pair without keeping it alive, see PhysicsHandler::getColliderPair
+typedef struct ColliderPairHandle {
+	uint32_t index = UINT32_MAX, generation = 0;
+} ColliderPairHandle;
+
+typedef void (*PhysicsPairCallbackFunc)(ColliderPair*, void*);
+
+typedef struct PhysicsPairCallback {
+	PhysicsPairCallbackFunc f = nullptr;
+	void* d = nullptr;
+} PhysicsPairCallback;
+
+// returns the current time in seconds; only differences between calls matter
+typedef double (*PhysicsClockFunc)(void*);
+
+typedef struct PhysicsClock {
+	PhysicsClockFunc f = nullptr;
+	void* d = nullptr;
+} PhysicsClock;
+
+typedef enum PhysicsBroadphaseType {
+	PH_BROADPHASE_NONE, // pairs are only ever created and (de)activated by the user
+	PH_BROADPHASE_ALL_PAIRS, // tests every pair of bounds, mostly useful as a reference
+	PH_BROADPHASE_SWEEP_AND_PRUNE,
+	/*
+	 * Rebuilds a uniform hashed grid every update; best for many similarly-sized small colliders (e.g.
+	 * particle spheres/points). Cell size should be around the diameter of the typical collider.
+	 */
+	PH_BROADPHASE_HASH_GRID
+} PhysicsBroadphaseType;
+
+// parts of a step, as timed by PhysicsHandler::setPhaseTiming
+typedef enum PhysicsPhase {
+	PH_PHASE_TIMED_VALUES,
+	PH_PHASE_INTEGRATE, // including waking islands and orientation updates
+	PH_PHASE_BROADPHASE,
+	PH_PHASE_NARROWPHASE,
+	PH_PHASE_CONTACTS,
+	PH_PHASE_CALLBACKS,
+	PH_PHASE_SLEEP,
+	PH_PHASE_COUNT
+} PhysicsPhase;
+
+#ifdef PH_STATS
+// what one step did, see PhysicsHandler::acquireStats
+typedef struct PhysicsStats {
+	uint64_t step = 0; // steps taken so far, 0 before the first
+	double phasetimes[PH_PHASE_COUNT] = {}; // wall time of each phase, in s
+	uint32_t pairschecked = 0; // collision functions run, so not counting pairs a batched screen ruled out
+	uint32_t collisions = 0; // bounces, i.e. collide events
+	uint32_t contacts = 0; // pairs in contact after the narrowphase
+	uint32_t couples = 0, decouples = 0;
+	uint32_t tritests = 0; // tris tested by point-mesh pairs
+} PhysicsStats;
+#endif
+
 typedef struct TimedValue {
 	Collider* c;
 	glm::vec3 v;
@@ -346,47 +1101,441 @@ typedef struct TimedValue {
  *     - Should be fine if we *just* cancel force/momentum in the anti-normal dir
  */
 
+/*
+ * Minimal fork-join pool. run splits [0, n) into one contiguous chunk per thread (the calling thread
+ * takes the first) and returns once every chunk is done.
+ */
+class PhysicsWorkerPool {
+public:
+	typedef std::function<void(uint8_t, uint32_t, uint32_t)> Job; // thread index, chunk begin, chunk end
+
+	PhysicsWorkerPool(uint8_t n);
+	~PhysicsWorkerPool();
+
+	void run(uint32_t n, const Job& f);
+
+	uint8_t getNumThreads() const {return numthreads;}
+
+private:
+	std::vector<std::thread> threads;
+	uint8_t numthreads; // including the calling thread
+	std::mutex mut;
+	std::condition_variable startcv, donecv;
+	const Job* job;
+	uint32_t jobsize;
+	uint64_t generation; // bumped per run so workers can tell a new job from a spurious wakeup
+	uint8_t remaining;
+	bool quit;
+
+	void work(uint8_t ti);
+	void chunk(uint8_t ti, uint32_t n, uint32_t& begin, uint32_t& end) const;
+};
+
+/*
+ * With a broadphase other than PH_BROADPHASE_NONE, pairs between colliders added through addCollider
+ * are created and activated automatically whenever their bounds overlap, and deactivated once they
+ * separate (unless they're still in contact). Pairs added by hand between such colliders are reused
+ * rather than duplicated, so their callbacks still fire; the active parameter of addColliderPair then
+ * just sets the pair's initial state, and an active one is deactivated like any other once the
+ * broadphase finds the colliders apart.
+ *
+ * Automatically created pairs have no callbacks; use setOnPairCreate to hook them up per type combination.
+ *
+ * Colliders whose layers don't collide (see Collider::setLayers) never get a pair from the broadphase,
+ * and active pairs between them, including ones added by hand, are skipped.
+ */
 class PhysicsHandler {
 public:
 	PhysicsHandler();
+	PhysicsHandler(PhysicsBroadphaseType b, float cellsize = PH_DEFAULT_GRID_CELL_SIZE);
 	~PhysicsHandler();
 
 	// so that dt doesn't accumulate during init optimizations
 	// call this as shortly before your first draw loop as possible
 	void start();
 	/*
-	 * Whole frame update calculates the position of all colliders after time elapsed from previous frame.
+	 * Whole frame update calculates the position of all colliders after time elapsed from previous frame,
+	 * as read from the clock (a steady high-resolution clock unless set with setClock).
 	 */
 	void update();
+	/*
+	 * Same as above but with the elapsed time given explicitly, e.g. for headless tests and replays.
+	 * Doesn't read or affect the clock.
+	 */
+	void update(float elapsed);
+
+	/*
+	 * With a nonzero step, updates advance the simulation in whole steps of exactly that length, carrying
+	 * leftover time over to the next update, so results don't depend on frame rate. At most maxsteps
+	 * steps are taken per update; any time beyond that is dropped so one long frame can't snowball.
+	 * Renderers should then draw colliders at getInterpolatedPos(getAlpha()).
+	 * Note timed values with dt == 0 then last one step rather than one update.
+	 */
+	void setFixedTimestep(float step, uint8_t maxsteps = PH_DEFAULT_MAX_SUBSTEPS);
+	void setClock(PhysicsClock c) {clock = c;}
+	/*
+	 * Off by default. When on, each step adds the wall time spent in each phase (always read from a
+	 * steady clock, not the one from setClock) to a running total, in s.
+	 */
+	void setPhaseTiming(bool t) {phasetiming = t;}
+	double getPhaseTime(PhysicsPhase p) const {return phasetimes[p];}
+	void resetPhaseTimes() {std::fill(phasetimes, phasetimes + PH_PHASE_COUNT, 0.);}
+	/*
+	 * With more than one thread, active pairs are greedily colored each step so no two pairs in a batch
+	 * share a finite-mass collider, and each batch is checked in parallel. Pairs therefore run in batch
+	 * order instead of activation order, which gives the same results for any thread count above one.
+	 * With one thread (the default) pairs are checked on the calling thread, grouped by collision function
+	 * (see sortByKernel) and in activation order within each group (see addColliderPair). That isn't the
+	 * order pairs were checked in before the dispatch tables, so results can differ slightly from older
+	 * versions.
+	 * Events (and so callbacks) come out in the same order for any thread count above one.
+	 * Contact islands are solved in parallel too, with the same results for any thread count.
+	 */
+	void setNumThreads(uint8_t n);
+	/*
+	 * On by default. Contact forces and friction impulses carry over from step to step as the starting
+	 * point for the next solve; off, each step solves from zero, which is mostly useful for comparison.
+	 */
+	void setWarmStarting(bool w) {warmstarting = w;}
+	// Gauss-Seidel sweeps the contact solver took over the last update, across all its passes (the slowest island's, per pass)
+	uint32_t getNumContactIterations() const {return contactiterations;}
+	/*
+	 * Steps on a thread of its own at a fixed step (see setFixedTimestep), paced by the clock, so
+	 * simulation can overlap with rendering. After every step the thread publishes every collider's
+	 * transform, which acquireFrame picks up without locking.
+	 * While it runs nothing else may touch the handler or its colliders directly; send changes through
+	 * pushCommand instead. Pair callbacks and pair create callbacks are called on the physics thread.
+	 * Add colliders before starting, or stop the thread around adding them.
+	 */
+	void startThread(float step, uint8_t maxsteps = PH_DEFAULT_MAX_SUBSTEPS);
+	// waits for the current update to finish; a no-op if the thread isn't running
+	void stopThread();
+	bool isThreaded() const {return threaded;}
+	// applied at the start of the physics thread's next update, false if the queue is full
+	bool pushCommand(const PhysicsCommand& c) {return commands.push(c);}
+	/*
+	 * The newest frame the physics thread has published, valid until the next call. Call from one
+	 * thread only (e.g. the render thread), and draw at getInterpolatedPos(ci, f.getAlpha(getClockTime())).
+	 */
+	const PhysicsFrame& acquireFrame() {return frames.acquire();}
+#ifdef PH_STATS
+	/*
+	 * Stats for the newest step, valid until the next call. Every step publishes them, threaded or not,
+	 * so like acquireFrame this never waits on the step; call from one thread only.
+	 */
+	const PhysicsStats& acquireStats() {return stats.acquire();}
+#endif
+	double getClockTime() const {return readClock();}
 
 	/*
 	 * This whole function is syntactic grossness, but basically we want to make sure the correct
 	 * assigment operator override gets called so we cast things around.
 	 *
 	 * For large things like MeshCollider, we'd rather not realloc so we work with an rvalue here.
+	 * Each collider class gets a PhysicsPool of its own, so colliders of a type sit together in memory.
 	 *
 	 * May be prudent to put in some requirements for what type can be passed in.
 	 */
 	template<class T>
 	Collider* addCollider(T&& c) {
-		colliders.push_back(new T(c));
+		colliders.push_back(getColliderPool<std::remove_cvref_t<T>>().create(std::forward<T>(c)));
+		registerCollider(colliders.back());
 		return colliders.back();
 	}
+	/*
+	 * Pairs are pooled, so removing one and adding another doesn't allocate. Activating and deactivating
+	 * are O(1); active pairs are checked in the order they were activated in, except that deactivating
+	 * one moves the last in that order into its place.
+	 * If the colliders already have a pair (e.g. one the broadphase made), that pair is returned instead,
+	 * with p's callbacks and preventdefault and the given active state, and keeps any contact it's in.
+	 */
 	ColliderPair* addColliderPair(ColliderPair&& p, bool active);
 	void removeColliderPair(ColliderPair* p);
 	void activateColliderPair(ColliderPair* p);
 	void deactivateColliderPair(ColliderPair* p);
+	ColliderPairHandle getHandle(const ColliderPair* p) const {return {pairpool.getIndex(p), pairpool.getGeneration(p)};}
+	// nullptr once the pair's been removed, even if its memory has gone to a newer pair
+	ColliderPair* getColliderPair(ColliderPairHandle h) const {return pairpool.get(h.index, h.generation);}
 
 	// rounds down; if dt == 0, will just apply during one update cycle
 	void addTimedMomentum(TimedValue&& t); 
 	void addTimedForce(TimedValue&& t); 
+	size_t getNumTimedValues() const {return timed.size();}
+
+	// called on every pair the broadphase creates between colliders of types t1 and t2 (in either order)
+	void setOnPairCreate(ColliderType t1, ColliderType t2, PhysicsPairCallback pc);
 
 	float getDT() {return dt;}
+	// fraction of a fixed step left in the accumulator, i.e. how far between the last two steps we are
+	float getAlpha() const {return fixeddt == 0 ? 1 : accumulator / fixeddt;}
+	uint8_t getNumSubsteps() const {return numsubsteps;} // steps taken by the last update
+	PhysicsBroadphaseType getBroadphase() const {return broadphase;}
+	size_t getNumColliders() const {return colliders.size();}
+
+	/*
+	 * Rebuilt (or refit) lazily on the first call after anything moved, so call it from one thread,
+	 * then hand the result to as many as needed. The reference stays valid for the handler's lifetime,
+	 * but its contents are only current until the next update or setPos.
+	 */
+	const PhysicsQuerySnapshot& getQuerySnapshot();
+	bool raycast(const PhysicsRay& r, PhysicsRayHit& hit) {return getQuerySnapshot().raycast(r, hit);}
+	bool sphereCast(const PhysicsRay& r, float rad, PhysicsRayHit& hit) {return getQuerySnapshot().sphereCast(r, rad, hit);}
+	size_t overlapSphere(const glm::vec3& c, float rad, std::vector<Collider*>& res, uint32_t mask = UINT32_MAX) {return getQuerySnapshot().overlapSphere(c, rad, res, mask);}
+	// split across the worker threads, see setNumThreads
+	void raycast(const PhysicsRay* rs, size_t n, PhysicsRayHit* hits);
+	Collider* getCollider(size_t i) {return colliders[i];} // in the order they were added
+	size_t getNumActivePairs() const {return numactivepairs;} // not counting sleeping pairs
+	/*
+	 * Sleeping colliders aren't integrated, and pairs with nothing awake and movable in them aren't
+	 * checked. Colliders connected through active pairs form islands that fall asleep together, and
+	 * wake together when any member is pushed, moved, or gets a new pair with something awake.
+	 * On by default; turning it off wakes everything.
+	 */
+	void setSleeping(bool s);
+	size_t getNumAsleep() const {return numasleep;}
+	/*
+	 * Everything that happened between pairs during the last update, in the order it happened.
+	 * Pair callbacks are called from this list at the end of each step, on the thread calling update,
+	 * rather than in the middle of resolving pairs.
+	 * Cleared at the start of each update, but the storage is kept so steady-state steps don't allocate.
+	 */
+	const std::vector<PhysicsEvent>& getEvents() const {return events;}
+
+	/*
+	 * Saves everything a step depends on: collider state, orientations, sleeping islands, timed values,
+	 * pair flags, order, and contact state, the broadphase's incremental state, and the accumulator. Reuses s's
+	 * storage, so saving every step doesn't allocate once it's grown.
+	 * Configuration (broadphase type, thread count, callbacks, fixed step) isn't included.
+	 */
+	void saveSnapshot(PhysicsSnapshot& s) const;
+	/*
+	 * Puts the simulation back to where it was when s was saved; replaying the same inputs from there
+	 * then gives the same results bit for bit. Pairs the broadphase created since are removed. Pairs
+	 * added by hand since are kept, but deactivated with their contact state cleared, and pairs removed
+	 * by hand since stay removed. Events are cleared.
+	 */
+	void restoreSnapshot(const PhysicsSnapshot& s);
 
 private:
+	typedef struct SAPEndpoint {
+		float v;
+		uint32_t ci; // index into colliders
+		bool max;
+	} SAPEndpoint;
+
+	typedef struct GridEntry {
+		uint32_t h; // hashed cell coords
+		uint32_t ci;
+	} GridEntry;
+
+	typedef struct GridCell {
+		AABB b;
+		uint32_t ci;
+	} GridCell;
+
+	typedef struct GridTable {
+		std::vector<GridEntry> entries;
+		std::vector<uint32_t> buckets; // start offsets into sorted
+		std::vector<GridCell> sorted;
+		std::vector<uint32_t> large; // colliders too big for the grid
+		uint32_t mask = 0;
+	} GridTable;
+
+	typedef struct TimedEntry {
+		double expiry; // in simulated s, see simtime
+		Collider* c;
+		glm::vec3 v;
+		bool force; // otherwise momentum
+	} TimedEntry;
+	static bool timedEntryLater(const TimedEntry& a, const TimedEntry& b) {return a.expiry > b.expiry;}
+
+	typedef struct SnapshotHeader {
+		uint32_t numcolliders, numoriented, numbounds, numendpoints, numpairs, numbpactive, numtimed, bpstamp;
+		uint64_t nextpairid;
+		double simtime;
+		float accumulator, dt;
+	} SnapshotHeader;
+
+	typedef struct SnapshotOrientation {
+		glm::quat r, dr, ddr;
+		glm::vec3 n; // only used by planes and rects
+	} SnapshotOrientation;
+
+	typedef struct SnapshotPair {
+		uint64_t id;
+		const void* nearest;
+		glm::vec3 nf, reldp, lreldp, dynf, netf, mn, mjt;
+		float mdepth;
+		uint32_t mage, bpstamp;
+		ColliderPairFlags f;
+		uint8_t active, pad[6]; // explicit, so there are no uninitialized padding bytes
+	} SnapshotPair;
+
 	std::vector<Collider*> colliders;
-	std::set<ColliderPair*> pairs, activepairs;
-	std::vector<TimedValue> tms, tfs;
+	std::unordered_map<std::type_index, PhysicsPoolBase*> colliderpools; // one per collider class
+	ColliderStore store; // state of everything in colliders
+	std::vector<Collider*> oriented; // subset of colliders needing updateOrientation
+	PhysicsPool<ColliderPair> pairpool;
+	/*
+	 * Every pair, with the active ones (minus those parked with a sleeping island) in the first
+	 * numactivepairs, in the order they're checked in. Each pair knows its index, so moving it
+	 * between the ranges is a swap.
+	 */
+	std::vector<ColliderPair*> pairs;
+	size_t numactivepairs;
+	uint64_t nextpairid;
+	// min-heap on expiry, so a step only has to look at the entries that are actually expiring
+	std::vector<TimedEntry> timed;
+	double simtime; // sum of all step dts so far
+
+	PhysicsBroadphaseType broadphase;
+	std::vector<AABB> bounds; // parallel to colliders
+	std::vector<SAPEndpoint> endpoints; // sorted along x, kept sorted incrementally between updates
+	std::vector<uint32_t> sapopen;
+	float gridcellsize;
+	GridTable grid; // awake colliders, rebuilt every step
+	GridTable gridasleep; // sleeping colliders, only rebuilt when some fall asleep or wake
+	bool gridasleepdirty;
+	/*
+	 * Every pair known to the handler, found by its colliders. Open addressing with linear probing, kept
+	 * at most half full, so lookups and inserts don't allocate once it's grown.
+	 */
+	std::vector<ColliderPair*> pairtable;
+	std::vector<ColliderPair*> bpactive, bpactivenext; // pairs the broadphase found overlapping
+	uint32_t bpstamp;
+	PhysicsPairCallback paircreatecallbacks[COLLIDER_TYPE_COUNT][COLLIDER_TYPE_COUNT];
+
+	bool sleeping;
+	std::vector<std::vector<uint32_t>> islands; // store slots in each sleeping island
+	std::vector<std::vector<ColliderPair*>> islandpairs; // active pairs parked with each sleeping island
+	std::vector<uint32_t> freeislands;
+	std::vector<uint32_t> islandparent; // union-find forest over store slots, rebuilt every step (twice, see solveContacts)
+	std::vector<uint8_t> islandawake; // per union-find root, whether any member is still above the thresholds
+	size_t numasleep;
+
+	bool warmstarting;
+	uint32_t contactiterations;
+	std::vector<ColliderPair*> contacts; // scratch for solveContacts, grouped by island once it's split them
+	// more scratch for solveContacts: contacts[contactislands[i]] onwards is island i
+	std::vector<uint32_t> contactislands, contactisland, islanditerations;
+	std::vector<uint32_t> rootislands; // per union-find root, its island; scratch for solveContacts and updateSleep
+	std::vector<ColliderPair*> contactsorted;
+
+	std::vector<PhysicsEvent> events;
+	std::vector<std::vector<PhysicsEvent>> threadevents; // per worker, appended to events after each batch
+
+	PhysicsWorkerPool* workers; // nullptr when single-threaded
+	std::vector<std::vector<ColliderPair*>> pairbatches; // conflict-free, rebuilt each step
+	std::vector<ColliderPair*> serialpairs; // pairs that couldn't be colored, or every awake pair when single-threaded
+	std::vector<ColliderPair*> kernelsorted; // scratch for sortByKernel
+	std::vector<uint64_t> colormasks; // per store slot, which batches already write to that collider
+
+	PhysicsClock clock;
+	float fixeddt; // 0 for variable steps
+	uint8_t maxsubsteps, numsubsteps;
+	float accumulator;
+	double ti, lastt; // in s, as read from clock
+	float dt; // length of the last step, in s
+
+	PhysicsQuerySnapshot querysnapshot;
+	uint64_t queryversion; // store version querysnapshot was made at
+
+	std::thread physicsthread;
+	std::atomic<bool> stopthread;
+	bool threaded; // set before the thread starts, so the thread itself can read it
+	PhysicsSPSCQueue<PhysicsCommand, PH_COMMAND_QUEUE_SIZE> commands;
+	PhysicsTripleBuffer<PhysicsFrame> frames;
+	std::vector<glm::quat> lastrots; // rotations as of the last published frame
+	uint64_t numpublished;
+
+	bool phasetiming;
+	double phasetimes[PH_PHASE_COUNT];
+	std::chrono::steady_clock::time_point phasestart;
+#ifdef PH_STATS
+	PhysicsTripleBuffer<PhysicsStats> stats;
+	uint64_t numsteps;
+#endif
 
-	float ti, lastt, dt; // in s
+	template<class T>
+	PhysicsPool<T>& getColliderPool() {
+		PhysicsPoolBase*& p = colliderpools[std::type_index(typeid(T))];
+		if (!p) p = new PhysicsPool<T>();
+		return *static_cast<PhysicsPool<T>*>(p);
+	}
+	std::span<ColliderPair* const> activePairs() const {return {pairs.data(), numactivepairs};}
+	void swapPairs(uint32_t a, uint32_t b);
+	// move a pair into or out of the active range, without touching its active flag
+	void enterActiveRange(ColliderPair* p) {if (p->slot >= numactivepairs) swapPairs(p->slot, numactivepairs++);}
+	void leaveActiveRange(ColliderPair* p) {
+		if (p->slot < numactivepairs) swapPairs(p->slot, --numactivepairs);
+#ifdef PH_STATS
+		// countStats only looks at active pairs, so don't let anything left over turn up once this is back
+		p->checks = p->tritests = 0;
+#endif
+	}
+
+	void step(float stepdt);
+	void threadLoop();
+	void applyCommands();
+	void fillFrame(PhysicsFrame& f, double t);
+	// adds the time since the last endPhase (or the start of the step) to p
+	void endPhase(PhysicsPhase p);
+#ifdef PH_STATS
+	// counts up the step's pairs and events once the contacts are solved
+	void countStats(size_t firstevent);
+#endif
+	void checkPairs();
+	/*
+	 * Gauss-Seidel over every awake pair in contact that has a manifold, in three passes: normal
+	 * forces so nothing in contact accelerates into anything else, then velocities (approach and
+	 * friction), then overlap past PH_CONTACT_SLOP. Forces stay applied until the next step or
+	 * a decouple, so a settled stack is already solved when the next step starts.
+	 * Contacts are first split into islands that share no movable collider. Each island is solved on
+	 * its own, in parallel with more than one thread, and stops iterating once it alone has converged.
+	 */
+	void solveContacts();
+	// the three passes over one island's contacts; iterations gets each pass's sweeps
+	void solveContactIsland(ColliderPair* const* cs, size_t n, uint32_t* iterations);
+	// 0 for anything contacts can't move, i.e. infinite or zero mass
+	float invMass(uint32_t si) const {return store.m[si] == std::numeric_limits<float>::infinity() || store.m[si] == 0 ? 0.f : 1 / store.m[si];}
+	/*
+	 * Awake and finite-mass, i.e. something a pair check could actually move, or static but put somewhere
+	 * new by hand since the last step (until the contacts are solved), which is just as likely to touch things.
+	 */
+	bool isMoving(const Collider* c) const {
+		if (c->getMass() == std::numeric_limits<float>::infinity()) return c->store == &store && store.moving[c->si];
+		return !c->isAsleep();
+	}
+	bool isPairAsleep(const ColliderPair* p) const {return !isMoving(p->c1) && !isMoving(p->c2);}
+	// pairs in contact are still checked until they decouple, or their contact forces would never be undone
+	bool isPairMasked(const ColliderPair* p) const {return !p->c1->collidesWith(p->c2) && !(p->f & COLLIDER_PAIR_FLAG_CONTACT);}
+	void integrateAwake();
+	void wakeTouchedIslands();
+	// wakes islands with a parked pair against a moved static collider, which the broadphase won't find as new
+	void wakeMovedAgainst();
+	void wakeIsland(uint32_t i);
+	uint32_t findIsland(uint32_t si);
+	void updateSleep();
+	void dispatchEvents(size_t first);
+	// rebuilds islands and parks pairs to match store.island, after a restore
+	void rebuildIslands();
+	void colorPairs();
+	// groups pairs by collision function so checkRuns can hand each group to one tight loop
+	void sortByKernel(std::vector<ColliderPair*>& ps);
+	void checkRuns(ColliderPair* const* ps, size_t n, std::vector<PhysicsEvent>& ev);
+	double readClock() const;
+	void registerCollider(Collider* c);
+	void updateBroadphase();
+	void updateBounds(uint32_t ci); // padded by PH_BROADPHASE_MARGIN
+	void allPairs();
+	void sweepAndPrune();
+	void hashGrid();
+	void buildGrid(GridTable& g, bool asleep);
+	void addCandidate(uint32_t ci1, uint32_t ci2);
+	// looks up the pair for these two colliders, creating it if this combination is supported
+	ColliderPair* getOrCreatePair(Collider* a, Collider* b);
+	size_t pairHash(const Collider* a, const Collider* b) const; // the same in either order
+	ColliderPair* findPair(const Collider* a, const Collider* b) const;
+	void insertPairLookup(ColliderPair* p); // replacing any pair between the same colliders
+	void erasePairLookup(const ColliderPair* p);
 };